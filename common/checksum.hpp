@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+constexpr uint64_t CHECKSUM_SEED = 0xcbf29ce484222325ull;
+
+// FNV-1a sobre palabras de 64 bits con un xorshift para mezclar los bits
+// altos hacia abajo. Detecta archivos truncados o corruptos; no es
+// criptográfico. Encadenable pasando el resultado anterior como h.
+inline uint64_t checksum(const void *data, size_t bytes,
+                         uint64_t h = CHECKSUM_SEED) {
+  constexpr uint64_t prime = 0x100000001b3ull;
+  const auto *p = static_cast<const unsigned char *>(data);
+
+  size_t i = 0;
+  for (; i + 8 <= bytes; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * prime;
+    h ^= h >> 29;
+  }
+  for (; i < bytes; ++i)
+    h = (h ^ p[i]) * prime;
+  return h;
+}
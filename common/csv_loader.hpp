@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dataset.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+
+// Cada hilo toma bloques de este tamaño, ajustados a inicio de línea
+constexpr size_t CSV_CHUNK_BYTES = size_t{1} << 20;
+
+// Filas mal formadas que se guardan con detalle en CsvReport
+constexpr size_t CSV_MAX_ISSUES = 16;
+
+struct CsvIssue {
+  size_t line;        // 1-based
+  const char *reason; // literal estático
+};
+
+struct CsvReport {
+  size_t rows = 0;      // filas cargadas
+  size_t malformed = 0; // filas descartadas
+  vector<CsvIssue> issues;
+};
+
+namespace csv_detail {
+
+inline const char *skipSpaces(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t'))
+    ++p;
+  return p;
+}
+
+// Lee un número y avanza p hasta el separador; false si no es válido
+template <class T> bool parseField(const char *&p, const char *end, T &out) {
+  p = skipSpaces(p, end);
+  if (p < end && *p == '+')
+    ++p;
+  auto [next, ec] = from_chars(p, end, out);
+  if (ec != errc{})
+    return false;
+  p = skipSpaces(next, end);
+  return p == end || *p == ',';
+}
+
+// Parsea "id,f1,...,fdims" en id/out. Devuelve nullptr si la fila es
+// válida o el motivo del descarte
+inline const char *parseRow(const char *p, const char *end, size_t dims,
+                            bool ignoreExtra, int &id, double *out) {
+  if (!parseField(p, end, id))
+    return "id no numérico";
+
+  for (size_t d = 0; d < dims; ++d) {
+    if (p == end)
+      return "faltan columnas";
+    ++p; // ','
+    if (!parseField(p, end, out[d]))
+      return "valor no numérico";
+  }
+
+  if (p != end && !ignoreExtra)
+    return "columnas de más";
+  return nullptr;
+}
+
+// Fin de la línea que empieza en p, sin '\r'
+inline const char *lineEnd(const char *p, const char *end,
+                           const char *&next) {
+  auto *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+  next = nl ? nl + 1 : end;
+  const char *e = nl ? nl : end;
+  if (e > p && e[-1] == '\r')
+    --e;
+  return e;
+}
+
+// Dataset de capacity filas con las rows primeras de data
+inline Dataset withCapacity(Dataset &data, size_t rows, size_t capacity,
+                            size_t dims) {
+  Dataset out(capacity, dims);
+  for (size_t r = 0; r < rows; ++r) {
+    copy_n(data.row(r), dims, out.row(r));
+    out.setId(r, data.id(r));
+  }
+  return out;
+}
+
+} // namespace csv_detail
+
+// Carga id,f1,f2,... directamente al buffer contiguo del Dataset. El
+// archivo se proyecta en memoria y se parsea en paralelo por bloques de
+// líneas con from_chars, sin excepciones.
+//
+//  - Una primera línea cuyo id no es numérico se toma como cabecera.
+//  - El número de columnas lo fija la primera fila de datos (recortado a
+//    numFeatures si se indica; entonces las columnas extra se ignoran).
+//  - Las filas mal formadas se descartan y se informan por cerr y en report.
+//  - maxRows limita las filas cargadas (-1 = todas); las descartadas no
+//    cuentan.
+//  - threads = 0 usa todos los núcleos.
+inline Dataset readDataset(const string &filename, int maxRows = -1,
+                           int numFeatures = -1, unsigned threads = 0,
+                           CsvReport *report = nullptr) {
+  using namespace csv_detail;
+
+  MappedFile file(filename);
+  if (!file.valid())
+    return {};
+  file.adviseSequential();
+
+  const char *begin = file.data(), *end = begin + file.size();
+
+  // Cabecera y número de columnas, en serie
+  size_t firstDataLine = 0, dims = 0;
+  bool found = false;
+  const char *p = begin;
+  bool seenLine = false;
+  for (size_t line = 0; p < end && !found; ++line) {
+    const char *next;
+    const char *e = lineEnd(p, end, next);
+    const char *q = p;
+    p = next;
+    if (skipSpaces(q, e) == e)
+      continue;
+
+    int id;
+    const char *fields = q;
+    if (!seenLine && !parseField(fields, e, id)) {
+      firstDataLine = line + 1;
+    } else {
+      dims = count(q, e, ',');
+      if (numFeatures >= 0)
+        dims = min(dims, size_t(numFeatures));
+      found = true;
+    }
+    seenLine = true;
+  }
+  if (!found || dims == 0)
+    return {};
+
+  // Bloques alineados a líneas: cada uno empieza tras el primer '\n' desde
+  // su posición nominal
+  size_t chunks = (file.size() + CSV_CHUNK_BYTES - 1) / CSV_CHUNK_BYTES;
+  vector<const char *> bounds(chunks + 1, end);
+  bounds[0] = begin;
+  for (size_t c = 1; c < chunks; ++c) {
+    const char *from = max(bounds[c - 1], begin + c * CSV_CHUNK_BYTES - 1);
+    auto *nl = static_cast<const char *>(memchr(from, '\n', end - from));
+    bounds[c] = nl ? nl + 1 : end;
+  }
+
+  threads = resolveThreads(threads);
+
+  // Primera pasada: líneas por bloque, para saber en qué fila escribe cada
+  // bloque sin sincronizarse con los demás
+  vector<size_t> firstLine(chunks + 1, 0);
+  parallelFor(chunks, 1, threads, [&](size_t lo, size_t hi, size_t) {
+    for (size_t c = lo; c < hi; ++c) {
+      size_t lines = 0;
+      for (const char *q = bounds[c]; q < bounds[c + 1]; ++lines) {
+        auto *nl =
+            static_cast<const char *>(memchr(q, '\n', bounds[c + 1] - q));
+        q = nl ? nl + 1 : bounds[c + 1];
+      }
+      firstLine[c + 1] = lines;
+    }
+  });
+  for (size_t c = 0; c < chunks; ++c)
+    firstLine[c + 1] += firstLine[c];
+
+  size_t lastLine = firstLine[chunks];
+  size_t wanted = maxRows >= 0 ? size_t(maxRows) : lastLine;
+
+  Dataset data(0, dims);
+  size_t rows = 0;
+  vector<vector<CsvIssue>> chunkIssues(chunks);
+  vector<size_t> chunkMalformed(chunks, 0);
+
+  // Las líneas en blanco o mal formadas no cuentan para maxRows: si una
+  // ventana de líneas deja menos filas válidas de las pedidas se lee otra
+  // con las que faltan
+  for (size_t lineLo = firstDataLine; rows < wanted && lineLo < lastLine;) {
+    size_t lineHi = min(lastLine, lineLo + (wanted - rows));
+    size_t window = lineHi - lineLo;
+    data = withCapacity(data, rows, rows + window, dims);
+    vector<char> valid(window, 0);
+
+    // Segunda pasada: cada línea va a su fila; las inválidas dejan hueco
+    parallelFor(chunks, 1, threads, [&](size_t lo, size_t hi, size_t) {
+      for (size_t c = lo; c < hi; ++c) {
+        if (firstLine[c + 1] <= lineLo || firstLine[c] >= lineHi)
+          continue;
+        size_t line = firstLine[c];
+        for (const char *q = bounds[c]; q < bounds[c + 1] && line < lineHi;
+             ++line) {
+          const char *next;
+          const char *e = lineEnd(q, bounds[c + 1], next);
+          const char *start = q;
+          q = next;
+
+          if (line < lineLo || skipSpaces(start, e) == e)
+            continue;
+
+          size_t slot = line - lineLo;
+          int id;
+          const char *reason = parseRow(start, e, dims, numFeatures >= 0, id,
+                                        data.row(rows + slot));
+          if (reason) {
+            if (chunkIssues[c].size() < CSV_MAX_ISSUES)
+              chunkIssues[c].push_back({line + 1, reason});
+            ++chunkMalformed[c];
+            continue;
+          }
+          data.setId(rows + slot, id);
+          valid[slot] = 1;
+        }
+      }
+    });
+
+    // Compacta las filas válidas conservando el orden del archivo
+    size_t from = rows;
+    for (size_t slot = 0; slot < window; ++slot) {
+      if (!valid[slot])
+        continue;
+      if (from + slot != rows) {
+        copy_n(data.row(from + slot), dims, data.row(rows));
+        data.setId(rows, data.id(from + slot));
+      }
+      ++rows;
+    }
+    lineLo = lineHi;
+  }
+  data.truncate(rows);
+  data.indexIds();
+
+  CsvReport local;
+  local.rows = rows;
+  for (size_t c = 0; c < chunks; ++c) {
+    local.malformed += chunkMalformed[c];
+    for (auto &issue : chunkIssues[c])
+      if (local.issues.size() < CSV_MAX_ISSUES)
+        local.issues.push_back(issue);
+  }
+
+  if (local.malformed > 0) {
+    cerr << "Aviso: " << local.malformed << " filas mal formadas en "
+         << filename << endl;
+    for (auto &issue : local.issues)
+      cerr << "  línea " << issue.line << ": " << issue.reason << endl;
+  }
+
+  if (report)
+    *report = move(local);
+  return data;
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "checksum.hpp"
+#include "mapped_file.hpp"
+#include "point.hpp"
+
+// Las filas empiezan alineadas a 64 bytes (una línea de caché, un registro
+// AVX-512); con padding el ancho de fila se redondea a DATASET_ROW_PAD
+constexpr size_t DATASET_ALIGNMENT = 64;
+constexpr size_t DATASET_ROW_PAD = DATASET_ALIGNMENT / sizeof(double);
+
+// Vista de solo lectura de las primeras rows filas y cols columnas de un
+// Dataset, sin copiar: las filas conservan el stride del buffer original.
+// Los árboles se construyen sobre vistas, así un barrido por dimensiones y
+// tamaños reutiliza siempre la misma matriz. No es dueña de la memoria.
+class DatasetView {
+  const double *base = nullptr;
+  size_t rows = 0;
+  size_t cols = 0;
+  size_t rowStride = 0;
+  const int *rowIds = nullptr;
+  const unordered_map<int, size_t> *idToRow = nullptr;
+
+public:
+  static constexpr size_t npos = size_t(-1);
+
+  DatasetView() = default;
+  DatasetView(const double *b, size_t n, size_t d, size_t stride,
+              const int *ids, const unordered_map<int, size_t> *index)
+      : base(b), rows(n), cols(d), rowStride(stride), rowIds(ids),
+        idToRow(index) {}
+
+  size_t size() const { return rows; }
+  bool empty() const { return rows == 0; }
+  size_t dims() const { return cols; }
+  size_t stride() const { return rowStride; }
+
+  const double *row(size_t r) const { return base + r * rowStride; }
+  int id(size_t r) const { return rowIds[r]; }
+
+  // Fila del id (la primera si está repetido) o npos si no está en la vista
+  size_t rowOf(int id) const {
+    if (!idToRow)
+      return npos;
+    auto it = idToRow->find(id);
+    return it == idToRow->end() || it->second >= rows ? npos : it->second;
+  }
+
+  PointView operator[](size_t r) const {
+    return PointView(span<const double>(row(r), cols), rowIds[r]);
+  }
+
+  vector<Point> toPoints() const {
+    vector<Point> points;
+    points.reserve(rows);
+    for (size_t r = 0; r < rows; ++r)
+      points.push_back((*this)[r].toPoint());
+    return points;
+  }
+
+  // Huella del contenido visible (tamaño, ids y columnas activas); los
+  // índices persistidos la guardan para detectar que el dataset cambió
+  uint64_t fingerprint() const {
+    uint64_t shape[2] = {rows, cols};
+    uint64_t h = checksum(shape, sizeof(shape));
+    h = checksum(rowIds, rows * sizeof(int), h);
+    for (size_t r = 0; r < rows; ++r)
+      h = checksum(row(r), cols * sizeof(double), h);
+    return h;
+  }
+};
+
+// Formato binario (versión 1), en el orden de bytes de la máquina:
+//   [cabecera][relleno hasta dataOffset][matriz rows x stride][ids int32]
+// dataOffset es múltiplo de alignment, así la matriz proyectada queda
+// alineada igual que un Dataset en memoria. Las columnas de relleno
+// (stride - dims) valen cero.
+constexpr char DATASET_MAGIC[8] = {'K', 'V', 'P', 'D', 'S', 'E', 'T', '\0'};
+constexpr uint32_t DATASET_VERSION = 1;
+constexpr uint32_t DATASET_DTYPE_F64 = 1;
+
+struct DatasetFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dtype;
+  uint64_t rows;
+  uint64_t dims;
+  uint64_t stride;    // doubles por fila
+  uint64_t alignment; // bytes
+  uint64_t dataOffset;
+  uint64_t idsOffset;
+};
+
+// Matriz de características N x D fila por fila en un único buffer alineado,
+// con el id de cada fila y el mapa inverso id -> fila. Los árboles leen las
+// coordenadas directamente de aquí en lugar de un vector por punto.
+//
+// La matriz y los ids pueden ser propios o estar proyectados desde un
+// archivo binario (mapBinary); en el segundo caso son de solo lectura y
+// row(r) / setId no deben usarse para escribir.
+class Dataset {
+  struct AlignedFree {
+    void operator()(double *p) const { free(p); }
+  };
+
+  unique_ptr<double[], AlignedFree> buffer;
+  vector<int> rowIds;
+  MappedFile mapping;
+
+  const double *base = nullptr;
+  const int *idsBase = nullptr;
+  size_t rows = 0;
+  size_t cols = 0;
+  size_t rowStride = 0;
+  unordered_map<int, size_t> idToRow;
+
+  static size_t alignUp(size_t bytes) {
+    return (bytes + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT *
+           DATASET_ALIGNMENT;
+  }
+
+public:
+  static constexpr size_t npos = size_t(-1);
+
+  Dataset() = default;
+
+  // Coordenadas a cero e ids = número de fila
+  Dataset(size_t n, size_t d, bool padded = true)
+      : rowIds(n), rows(n), cols(d),
+        rowStride(padded ? (d + DATASET_ROW_PAD - 1) / DATASET_ROW_PAD *
+                               DATASET_ROW_PAD
+                         : d) {
+    size_t bytes = alignUp(rows * rowStride * sizeof(double));
+    if (bytes > 0) {
+      buffer.reset(
+          static_cast<double *>(aligned_alloc(DATASET_ALIGNMENT, bytes)));
+      memset(buffer.get(), 0, bytes);
+    }
+    base = buffer.get();
+    idsBase = rowIds.data();
+    for (size_t r = 0; r < rows; ++r)
+      rowIds[r] = int(r);
+    indexIds();
+  }
+
+  Dataset(Dataset &&) = default;
+  Dataset &operator=(Dataset &&) = default;
+
+  // Los puntos con menos de d coordenadas se completan con ceros
+  static Dataset fromPoints(const vector<Point> &points, bool padded = true) {
+    size_t d = points.empty() ? 0 : points[0].size();
+    Dataset data(points.size(), d, padded);
+    for (size_t r = 0; r < points.size(); ++r) {
+      copy_n(points[r].coords.begin(), min(d, points[r].size()), data.row(r));
+      data.rowIds[r] = points[r].id;
+    }
+    data.indexIds();
+    return data;
+  }
+
+  // Proyecta un archivo escrito con saveBinary sin copiar la matriz ni los
+  // ids; solo el índice id -> fila se construye en memoria. Si el archivo
+  // no es válido se informa por cerr y se devuelve un Dataset vacío.
+  static Dataset mapBinary(const string &path) {
+    Dataset data;
+    data.mapping = MappedFile(path);
+    if (!data.mapping.valid())
+      return {};
+
+    DatasetFileHeader h;
+    if (data.mapping.size() < sizeof(h)) {
+      cerr << "Error: " << path << " no es un dataset binario" << endl;
+      return {};
+    }
+    memcpy(&h, data.mapping.data(), sizeof(h));
+
+    if (memcmp(h.magic, DATASET_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != DATASET_VERSION) {
+      cerr << "Error: " << path << " no es un dataset binario v"
+           << DATASET_VERSION << endl;
+      return {};
+    }
+    if (h.dtype != DATASET_DTYPE_F64) {
+      cerr << "Error: " << path << " usa un tipo de dato no soportado ("
+           << h.dtype << ")" << endl;
+      return {};
+    }
+    uint64_t cells, matrixEnd, idsEnd;
+    if (h.stride < h.dims || h.alignment != DATASET_ALIGNMENT ||
+        h.dataOffset < sizeof(h) || h.dataOffset % DATASET_ALIGNMENT != 0 ||
+        h.idsOffset % alignof(int32_t) != 0 ||
+        __builtin_mul_overflow(h.rows, h.stride, &cells) ||
+        !sectionEnd(h.dataOffset, cells, sizeof(double), matrixEnd) ||
+        matrixEnd > h.idsOffset ||
+        !sectionEnd(h.idsOffset, h.rows, sizeof(int32_t), idsEnd) ||
+        idsEnd > data.mapping.size()) {
+      cerr << "Error: " << path << " está truncado o corrupto" << endl;
+      return {};
+    }
+
+    data.base =
+        reinterpret_cast<const double *>(data.mapping.data() + h.dataOffset);
+    data.idsBase =
+        reinterpret_cast<const int *>(data.mapping.data() + h.idsOffset);
+    data.rows = h.rows;
+    data.cols = h.dims;
+    data.rowStride = h.stride;
+    data.indexIds();
+    return data;
+  }
+
+  // Escribe el formato binario descrito arriba; false si falla
+  bool saveBinary(const string &path) const {
+    ofstream out(path, ios::binary);
+    if (!out.is_open()) {
+      cerr << "Error: No se pudo crear el archivo " << path << endl;
+      return false;
+    }
+
+    size_t matrixBytes = rows * rowStride * sizeof(double);
+    DatasetFileHeader h{};
+    memcpy(h.magic, DATASET_MAGIC, sizeof(h.magic));
+    h.version = DATASET_VERSION;
+    h.dtype = DATASET_DTYPE_F64;
+    h.rows = rows;
+    h.dims = cols;
+    h.stride = rowStride;
+    h.alignment = DATASET_ALIGNMENT;
+    h.dataOffset = alignUp(sizeof(h));
+    h.idsOffset = h.dataOffset + alignUp(matrixBytes);
+
+    vector<char> padding(DATASET_ALIGNMENT, 0);
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    out.write(padding.data(), h.dataOffset - sizeof(h));
+    out.write(reinterpret_cast<const char *>(base), matrixBytes);
+    out.write(padding.data(), h.idsOffset - h.dataOffset - matrixBytes);
+    out.write(reinterpret_cast<const char *>(idsBase), rows * sizeof(int32_t));
+
+    if (!out) {
+      cerr << "Error: No se pudo escribir " << path << endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool isMapped() const { return mapping.valid(); }
+
+  // Primeras n filas y d columnas, sin copiar
+  DatasetView view(size_t n = npos, size_t d = npos) const {
+    return DatasetView(base, min(n, rows), min(d, cols), rowStride, idsBase,
+                       &idToRow);
+  }
+  operator DatasetView() const { return view(); }
+
+  size_t size() const { return rows; }
+  bool empty() const { return rows == 0; }
+  size_t dims() const { return cols; }
+  size_t stride() const { return rowStride; }
+
+  const double *data() const { return base; }
+  const double *row(size_t r) const { return base + r * rowStride; }
+  // Escritura solo en un Dataset propio; proyectado es de solo lectura
+  double *row(size_t r) { return const_cast<double *>(base) + r * rowStride; }
+
+  int id(size_t r) const { return idsBase[r]; }
+  span<const int> ids() const { return {idsBase, rows}; }
+
+  // Descarta las filas desde n (el buffer conserva su tamaño); igual que
+  // tras setId, hay que llamar a indexIds
+  void truncate(size_t n) {
+    rows = min(n, rows);
+    if (!isMapped())
+      rowIds.resize(rows);
+  }
+
+  // Tras cambiar ids con setId hay que llamar a indexIds para que rowOf
+  // los vea; así los cargadores pueden escribir filas desde varios hilos
+  void setId(size_t r, int id) { rowIds[r] = id; }
+  void indexIds() {
+    idToRow.clear();
+    idToRow.reserve(rows);
+    for (size_t r = 0; r < rows; ++r)
+      idToRow.emplace(idsBase[r], r);
+  }
+
+  // Fila del id (la primera si está repetido) o npos si no existe
+  size_t rowOf(int id) const { return view().rowOf(id); }
+
+  PointView operator[](size_t r) const { return view()[r]; }
+  vector<Point> toPoints() const { return view().toPoints(); }
+};
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "csv_loader.hpp"
+#include "dataset.hpp"
 #include "point.hpp"
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -11,56 +14,36 @@
 
 inline vector<Point> readCSV(const string &filename, int maxRows = -1,
                              int numFeatures = -1) {
-  ifstream file(filename);
-  vector<Point> points;
-  string line;
-  int rowCount = 0;
-
-  if (!file.is_open()) {
-    cerr << "Error: No se pudo abrir el archivo " << filename << endl;
-    return points;
-  }
-
-  while (getline(file, line) && (maxRows == -1 || rowCount < maxRows)) {
-    stringstream ss(line);
-    string value;
-
-    if (!getline(ss, value, ','))
-      continue;
-
-    int id;
-    try {
-      id = stoi(value);
-    } catch (...) {
-      // cerr << "Error al leer ID: " << value << endl;
-      continue;
-    }
-
-    vector<double> coords;
-    int featureCount = 0;
-
-    while (getline(ss, value, ',')) {
-      if (numFeatures != -1 && featureCount >= numFeatures)
-        break;
+  return readDataset(filename, maxRows, numFeatures).toPoints();
+}
 
-      try {
-        coords.push_back(stod(value));
-        featureCount++;
-      } catch (...) {
-        cerr << "Error al convertir valor: " << value << endl;
-        coords.push_back(0.0);
-        featureCount++;
+// Usa la versión binaria del CSV (mismo nombre con extensión .bin, ver
+// tools/csv_to_bin) si existe y no es más antigua; si no, parsea el CSV
+inline Dataset loadDataset(const string &csvPath, int maxRows = -1) {
+  namespace fs = std::filesystem;
+  fs::path binPath = fs::path(csvPath).replace_extension(".bin");
+
+  error_code binError, csvError;
+  auto binTime = fs::last_write_time(binPath, binError);
+  auto csvTime = fs::last_write_time(csvPath, csvError);
+
+  if (!binError) {
+    if (!csvError && binTime < csvTime) {
+      cerr << "Aviso: " << binPath.string() << " es más antiguo que "
+           << csvPath << ", se usa el CSV" << endl;
+    } else {
+      Dataset data = Dataset::mapBinary(binPath.string());
+      if (!data.empty()) {
+        if (maxRows >= 0) {
+          data.truncate(maxRows);
+          data.indexIds();
+        }
+        return data;
       }
     }
-
-    if (!coords.empty()) {
-      points.emplace_back(coords, id);
-      rowCount++;
-    }
   }
 
-  file.close();
-  return points;
+  return readDataset(csvPath, maxRows);
 }
 
 inline void saveMetricsToCSV(const string &filename,
@@ -92,3 +75,44 @@ inline void saveMetricsToCSV(const string &filename,
   file.close();
   cout << "Métricas guardadas en " << filename << endl;
 }
+
+// Distancias al cuadrado de los k vecinos exactos de q por fuerza bruta,
+// de menor a mayor: referencia para medir el recall de las búsquedas
+// aproximadas
+inline vector<double> bruteForceKnn(const DatasetView &data, const double *q,
+                                    int k) {
+  vector<double> dists(data.size());
+  for (size_t r = 0; r < data.size(); ++r)
+    dists[r] = squaredDistance(data.row(r), q, data.dims());
+
+  size_t n = min<size_t>(max(k, 0), dists.size());
+  partial_sort(dists.begin(), dists.begin() + n, dists.end());
+  dists.resize(n);
+  return dists;
+}
+
+// Recall@k con empates: un id de found acierta si su punto no está más
+// lejos de q que el k-ésimo vecino exacto (exact, de bruteForceKnn)
+inline double recallAtK(const DatasetView &data, const double *q,
+                        const vector<int> &found,
+                        const vector<double> &exact) {
+  if (exact.empty())
+    return 1.0;
+  size_t hits = 0;
+  for (int id : found) {
+    size_t row = data.rowOf(id);
+    if (row != DatasetView::npos &&
+        squaredDistance(data.row(row), q, data.dims()) <= exact.back())
+      hits++;
+  }
+  return double(min(hits, exact.size())) / exact.size();
+}
+
+// Columnas de recall_latencia_*.csv, comunes a kd_tree_stats y
+// vp_tree_stats para graficarlos juntos
+inline const vector<string> RECALL_CSV_HEADERS = {
+    "dimensiones", "datos_entrenamiento",
+    "k_vecinos",   "indice",
+    "arboles",     "epsilon",
+    "max_checks",  "recall",
+    "tiempo_busqueda_promedio_ns", "distancias_promedio"};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+
+// Tamaño del subárbol izquierdo de un árbol binario completo de n nodos.
+// Partir por esta posición (en vez de la mediana exacta) deja el árbol
+// almacenable por niveles sin huecos: hijos de i en 2i+1 y 2i+2.
+inline size_t leftSubtreeSize(size_t n) {
+  if (n <= 1)
+    return 0;
+
+  size_t h = std::bit_width(n) - 1;
+  size_t full = (size_t{1} << h) - 1;
+  size_t lastLevel = n - full;
+  size_t halfLastLevel = size_t{1} << (h - 1);
+
+  return (full - 1) / 2 + std::min(lastLevel, halfLastLevel);
+}
+
+// Inicio del rango de filas del nodo q (0-based) del nivel `level` en un
+// árbol perfecto de n filas partido siempre por la mitad; el nodo cubre
+// [implicitRangeBegin(n, level, q), implicitRangeBegin(n, level, q + 1)).
+inline size_t implicitRangeBegin(size_t n, int level, size_t q) {
+  return (q * n) >> level;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// end = offset + count * size, o false si el cálculo desborda: los campos
+// de la cabecera de un archivo corrupto no deben pasar las comprobaciones
+// de límites dando la vuelta
+inline bool sectionEnd(std::uint64_t offset, std::uint64_t count,
+                       std::uint64_t size, std::uint64_t &end) {
+  return !__builtin_mul_overflow(count, size, &end) &&
+         !__builtin_add_overflow(offset, end, &end);
+}
+
+// Archivo proyectado en memoria de solo lectura. Las páginas se cargan al
+// tocarlas y se comparten (page cache) entre procesos que abren el mismo
+// archivo. Si no se puede abrir, valid() es false y se informa por cerr.
+class MappedFile {
+  const char *bytes = nullptr;
+  size_t length = 0;
+
+  void release() {
+    if (bytes)
+      munmap(const_cast<char *>(bytes), length);
+    bytes = nullptr;
+    length = 0;
+  }
+
+public:
+  MappedFile() = default;
+
+  explicit MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Error: No se pudo abrir el archivo " << path << std::endl;
+      return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        bytes = static_cast<const char *>(p);
+        length = st.st_size;
+      } else {
+        std::cerr << "Error: No se pudo proyectar el archivo " << path
+                  << std::endl;
+      }
+    }
+    ::close(fd);
+  }
+
+  MappedFile(MappedFile &&other) noexcept
+      : bytes(std::exchange(other.bytes, nullptr)),
+        length(std::exchange(other.length, 0)) {}
+
+  MappedFile &operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+      release();
+      bytes = std::exchange(other.bytes, nullptr);
+      length = std::exchange(other.length, 0);
+    }
+    return *this;
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() { release(); }
+
+  // Un archivo vacío se abre pero no se proyecta
+  bool valid() const { return bytes != nullptr; }
+  const char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+  // Pista al kernel para lecturas secuenciales (lectura anticipada)
+  void adviseSequential() const {
+    if (bytes)
+      madvise(const_cast<char *>(bytes), length, MADV_SEQUENTIAL);
+  }
+};
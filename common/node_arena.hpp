@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Nodos de tamaño fijo en bloques contiguos que solo crecen. Los nodos no se
+// liberan uno a uno: clear() o el destructor sueltan los bloques de una vez
+// (y solo recorren los nodos si T tiene destructor no trivial), sin la
+// cadena recursiva de destructores de un árbol de unique_ptr.
+template <class T> class NodeArena {
+  struct Block {
+    T *nodes;
+    size_t used;
+    size_t capacity;
+  };
+
+  std::vector<Block> blocks;
+  size_t blockNodes;
+
+  static T *allocate(size_t n) {
+    return static_cast<T *>(
+        ::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+  }
+
+  // Bloque con al menos n huecos libres al final; si hay que crearlo tiene
+  // al menos minNodes
+  Block &room(size_t n, size_t minNodes) {
+    if (blocks.empty() || blocks.back().capacity - blocks.back().used < n) {
+      size_t capacity = std::max(n, minNodes);
+      blocks.push_back({allocate(capacity), 0, capacity});
+    }
+    return blocks.back();
+  }
+
+public:
+  // Tramo contiguo de huecos sin construir. Un build paralelo lo reparte
+  // con split entre subárboles y cada tarea construye en el suyo sin
+  // sincronizarse; todos los huecos del tramo deben construirse.
+  struct Slots {
+    T *next = nullptr;
+    T *end = nullptr;
+
+    template <class... Args> T *make(Args &&...args) {
+      return ::new (static_cast<void *>(next++))
+          T(std::forward<Args>(args)...);
+    }
+
+    // Separa los n primeros huecos en otro tramo
+    Slots split(size_t n) {
+      Slots first{next, next + n};
+      next += n;
+      return first;
+    }
+  };
+
+  explicit NodeArena(size_t blockNodes = 1024) : blockNodes(blockNodes) {}
+
+  NodeArena(NodeArena &&other) noexcept
+      : blocks(std::exchange(other.blocks, {})),
+        blockNodes(other.blockNodes) {}
+
+  NodeArena &operator=(NodeArena &&other) noexcept {
+    if (this != &other) {
+      clear();
+      blocks = std::exchange(other.blocks, {});
+      blockNodes = other.blockNodes;
+    }
+    return *this;
+  }
+
+  NodeArena(const NodeArena &) = delete;
+  NodeArena &operator=(const NodeArena &) = delete;
+
+  ~NodeArena() { clear(); }
+
+  // Un nodo más al final, en orden de creación (inserciones)
+  template <class... Args> T *make(Args &&...args) {
+    Block &b = room(1, blockNodes);
+    return ::new (static_cast<void *>(b.nodes + b.used++))
+        T(std::forward<Args>(args)...);
+  }
+
+  // n huecos contiguos para construir un árbol completo (build); el bloque
+  // se ajusta a n para no sobredimensionar árboles pequeños
+  Slots take(size_t n) { return carve(n, n); }
+
+  // n huecos contiguos más al final, en bloques de al menos blockNodes como
+  // make (p. ej. las coordenadas de un nodo insertado)
+  Slots append(size_t n) { return carve(n, blockNodes); }
+
+  void clear() {
+    for (auto &b : blocks) {
+      if constexpr (!std::is_trivially_destructible_v<T>)
+        std::destroy_n(b.nodes, b.used);
+      ::operator delete(b.nodes, std::align_val_t(alignof(T)));
+    }
+    blocks.clear();
+  }
+
+  size_t size() const {
+    size_t n = 0;
+    for (auto &b : blocks)
+      n += b.used;
+    return n;
+  }
+
+  // Memoria reservada, incluidos los huecos libres del último bloque
+  size_t bytes() const {
+    size_t n = 0;
+    for (auto &b : blocks)
+      n += b.capacity * sizeof(T);
+    return n;
+  }
+
+private:
+  // n huecos contiguos; si hay que crear bloque tiene al menos minNodes
+  Slots carve(size_t n, size_t minNodes) {
+    Block &b = room(n, minNodes);
+    Slots slots{b.nodes + b.used, b.nodes + b.used + n};
+    b.used += n;
+    return slots;
+  }
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Por debajo de este tamaño la selección paralela no compensa lanzar hilos
+constexpr size_t PARALLEL_SELECT_CUTOFF = size_t{1} << 15;
+
+inline unsigned resolveThreads(unsigned threads) {
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+  return std::max(1u, threads);
+}
+
+// Ejecuta f(0), ..., f(tasks - 1) en hilos propios (f(0) en el hilo actual)
+template <class F> void runParallel(size_t tasks, F &&f) {
+  std::vector<std::thread> workers;
+  workers.reserve(tasks > 0 ? tasks - 1 : 0);
+  for (size_t t = 1; t < tasks; ++t)
+    workers.emplace_back([&f, t] { f(t); });
+  if (tasks > 0)
+    f(0);
+  for (auto &w : workers)
+    w.join();
+}
+
+// Reparte [0, n) en bloques de `grain` que los hilos van tomando de un
+// contador compartido; f(begin, end, worker) con worker en [0, threads)
+template <class F>
+void parallelFor(size_t n, size_t grain, unsigned threads, F &&f) {
+  grain = std::max<size_t>(grain, 1);
+  size_t tasks = std::min<size_t>(threads, (n + grain - 1) / grain);
+  std::atomic<size_t> next{0};
+
+  runParallel(tasks, [&](size_t worker) {
+    for (;;) {
+      size_t begin = next.fetch_add(grain);
+      if (begin >= n)
+        break;
+      f(begin, std::min(n, begin + grain), worker);
+    }
+  });
+}
+
+// Partición estable en paralelo: cada hilo cuenta su tramo, se calculan los
+// desplazamientos de destino y se reparte a un buffer en una segunda pasada.
+// Devuelve el primer elemento que no cumple pred.
+template <class It, class Pred>
+It parallelPartition(It first, It last, Pred pred, unsigned threads) {
+  using T = typename std::iterator_traits<It>::value_type;
+
+  size_t n = last - first;
+  size_t tasks = std::min<size_t>(threads, n);
+  if (tasks <= 1)
+    return std::stable_partition(first, last, pred);
+
+  size_t chunk = (n + tasks - 1) / tasks;
+  std::vector<size_t> matches(tasks);
+
+  runParallel(tasks, [&](size_t t) {
+    size_t lo = std::min(n, t * chunk), hi = std::min(n, lo + chunk);
+    matches[t] = std::count_if(first + lo, first + hi, pred);
+  });
+
+  std::vector<size_t> trueAt(tasks), falseAt(tasks);
+  size_t totalTrue = 0;
+  for (size_t t = 0; t < tasks; ++t)
+    totalTrue += matches[t];
+
+  size_t seenTrue = 0;
+  for (size_t t = 0; t < tasks; ++t) {
+    size_t lo = std::min(n, t * chunk);
+    trueAt[t] = seenTrue;
+    falseAt[t] = totalTrue + (lo - seenTrue);
+    seenTrue += matches[t];
+  }
+
+  std::vector<T> buffer(n);
+  runParallel(tasks, [&](size_t t) {
+    size_t lo = std::min(n, t * chunk), hi = std::min(n, lo + chunk);
+    size_t yes = trueAt[t], no = falseAt[t];
+    for (size_t i = lo; i < hi; ++i) {
+      if (pred(first[i]))
+        buffer[yes++] = std::move(first[i]);
+      else
+        buffer[no++] = std::move(first[i]);
+    }
+  });
+
+  runParallel(tasks, [&](size_t t) {
+    size_t lo = std::min(n, t * chunk), hi = std::min(n, lo + chunk);
+    std::move(buffer.begin() + lo, buffer.begin() + hi, first + lo);
+  });
+
+  return first + totalTrue;
+}
+
+// nth_element con particiones paralelas (quickselect de tres vías) mientras
+// el rango es grande; el resto lo termina std::nth_element
+template <class It, class Comp>
+void parallelNthElement(It first, It nth, It last, Comp comp,
+                        unsigned threads) {
+  using T = typename std::iterator_traits<It>::value_type;
+
+  while (threads > 1 && size_t(last - first) > PARALLEL_SELECT_CUTOFF) {
+    size_t n = last - first;
+
+    // Pivote: elemento de una muestra con el mismo rango relativo que nth
+    constexpr size_t SAMPLES = 64;
+    std::vector<T> sample;
+    sample.reserve(SAMPLES);
+    for (size_t s = 0; s < SAMPLES; ++s)
+      sample.push_back(first[s * n / SAMPLES]);
+    auto rank = sample.begin() + (nth - first) * SAMPLES / n;
+    std::nth_element(sample.begin(), rank, sample.end(), comp);
+    T pivot = *rank;
+
+    It less = parallelPartition(
+        first, last, [&](const T &x) { return comp(x, pivot); }, threads);
+    if (nth < less) {
+      last = less;
+      continue;
+    }
+
+    It equal = parallelPartition(
+        less, last, [&](const T &x) { return !comp(pivot, x); }, threads);
+    if (nth < equal)
+      return;
+
+    first = equal;
+  }
+
+  std::nth_element(first, nth, last, comp);
+}
@@ -1,10 +1,74 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstddef>
+#include <span>
+#include <type_traits>
 #include <vector>
 
+#include "simd_distance.hpp"
+
 using namespace std;
 
+// Dimensión fijada en compilación; DYNAMIC_DIMS indica dimensión en ejecución
+constexpr size_t DYNAMIC_DIMS = 0;
+
+template <size_t D>
+using CoordStorage =
+    conditional_t<D == DYNAMIC_DIMS, vector<double>, array<double, D>>;
+
+// Con dimensión dinámica usa el kernel SIMD elegido en ejecución; con D fija
+// el bucle queda desenrollado en línea, más barato que la llamada indirecta
+// para las dimensiones pequeñas que se especializan
+template <size_t D = DYNAMIC_DIMS>
+inline double squaredDistance(const double *a, const double *b,
+                              size_t dims = D) {
+  if constexpr (D == DYNAMIC_DIMS) {
+    return simd::l2sq(a, b, dims);
+  } else {
+    double dist = 0.0;
+    for (size_t i = 0; i < D; ++i) {
+      double diff = a[i] - b[i];
+      dist += diff * diff;
+    }
+    return dist;
+  }
+}
+
+template <size_t D> CoordStorage<D> makeCoords(const double *c, size_t n) {
+  if constexpr (D == DYNAMIC_DIMS) {
+    return vector<double>(c, c + n);
+  } else {
+    array<double, D> coords{};
+    copy_n(c, min(D, n), coords.begin());
+    return coords;
+  }
+}
+
+template <size_t D> CoordStorage<D> makeCoords(const vector<double> &c) {
+  return makeCoords<D>(c.data(), c.size());
+}
+
+// Invoca f con la dimensión como constante de compilación si hay una
+// instancia especializada (2, 6, 10, 14), o con DYNAMIC_DIMS si no.
+// VP_tree instancia explícitamente estas mismas dimensiones en vp_tree.cpp.
+template <class F> decltype(auto) dispatchDims(size_t dims, F &&f) {
+  switch (dims) {
+  case 2:
+    return f(integral_constant<size_t, 2>{});
+  case 6:
+    return f(integral_constant<size_t, 6>{});
+  case 10:
+    return f(integral_constant<size_t, 10>{});
+  case 14:
+    return f(integral_constant<size_t, 14>{});
+  default:
+    return f(integral_constant<size_t, DYNAMIC_DIMS>{});
+  }
+}
+
 class Point {
 public:
   vector<double> coords;
@@ -13,14 +77,28 @@ public:
   Point(const vector<double> &c = {}, int i = -1) : coords(c), id(i) {}
 
   double distance(const Point &other) const {
-    double dist = 0.0;
-    for (size_t i = 0; i < coords.size(); ++i) {
-      double diff = coords[i] - other.coords[i];
-      dist += diff * diff;
-    }
-    return sqrt(dist);
+    return simd::l2(coords.data(), other.coords.data(), coords.size());
   }
 
   double operator[](size_t i) const { return coords[i]; }
   size_t size() const { return coords.size(); }
 };
+
+// Vista de un punto sin copiar sus coordenadas (una fila de un Dataset o
+// un Point); no es dueña de la memoria
+struct PointView {
+  span<const double> coords;
+  int id = -1;
+
+  PointView() = default;
+  PointView(span<const double> c, int i) : coords(c), id(i) {}
+  PointView(const Point &p) : coords(p.coords), id(p.id) {}
+
+  const double *data() const { return coords.data(); }
+  double operator[](size_t i) const { return coords[i]; }
+  size_t size() const { return coords.size(); }
+
+  Point toPoint() const {
+    return Point(vector<double>(coords.begin(), coords.end()), id);
+  }
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+// Métricas de búsqueda propiedad del llamador: los árboles no guardan estado
+// durante una consulta, así varios hilos pueden consultar el mismo índice.
+// Cada hilo usa sus propias SearchStats y se combinan con +=.
+struct SearchStats {
+  size_t queries{};
+  size_t visitedNodes{};     // nodos (internos u hojas) recorridos
+  size_t distanceCalls{};    // distancias punto a punto evaluadas
+  size_t truncatedQueries{}; // consultas cortadas por un límite de distancias
+  double searchTimeNs{};
+
+  SearchStats &operator+=(const SearchStats &other) {
+    queries += other.queries;
+    visitedNodes += other.visitedNodes;
+    distanceCalls += other.distanceCalls;
+    truncatedQueries += other.truncatedQueries;
+    searchTimeNs += other.searchTimeNs;
+    return *this;
+  }
+};
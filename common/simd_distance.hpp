@@ -0,0 +1,255 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <string_view>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define SIMD_DISTANCE_X86 1
+#include <immintrin.h>
+#endif
+
+// Kernels de distancia euclidiana con selección en tiempo de ejecución
+// (CPUID) entre AVX-512, AVX2, SSE2 y escalar. Cada variante se compila con
+// su propio atributo target, así el binario no depende de -march y corre en
+// cualquier máquina de la flota. La variante puede forzarse con la variable
+// de entorno SIMD_KERNEL=avx512|avx2|sse2|scalar.
+//
+//  - l2sq(a, b, n): distancia al cuadrado entre dos vectores de n doubles.
+//  - l2sqBlock(q, block, count, n, out): distancias al cuadrado de q a los
+//    count puntos de un bloque SoA (coordenada d del punto r en
+//    block[d * count + r]), vectorizando sobre los puntos.
+
+namespace simd {
+
+struct DistanceKernels {
+  const char *name;
+  double (*l2sq)(const double *a, const double *b, size_t n);
+  void (*l2sqBlock)(const double *q, const double *block, size_t count,
+                    size_t n, double *out);
+};
+
+namespace detail {
+
+inline double l2sqScalar(const double *a, const double *b, size_t n) {
+  double sum = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    double diff = a[i] - b[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+inline void l2sqBlockScalar(const double *q, const double *block,
+                            size_t count, size_t n, double *out) {
+  for (size_t r = 0; r < count; ++r)
+    out[r] = 0.0;
+  for (size_t d = 0; d < n; ++d) {
+    const double *column = block + d * count;
+    for (size_t r = 0; r < count; ++r) {
+      double diff = column[r] - q[d];
+      out[r] += diff * diff;
+    }
+  }
+}
+
+#ifdef SIMD_DISTANCE_X86
+
+__attribute__((target("sse2"))) inline double
+l2sqSse2(const double *a, const double *b, size_t n) {
+  __m128d acc = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d diff = _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+    acc = _mm_add_pd(acc, _mm_mul_pd(diff, diff));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  double sum = lanes[0] + lanes[1];
+  for (; i < n; ++i) {
+    double diff = a[i] - b[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+__attribute__((target("sse2"))) inline void
+l2sqBlockSse2(const double *q, const double *block, size_t count, size_t n,
+              double *out) {
+  size_t r = 0;
+  for (; r + 2 <= count; r += 2) {
+    __m128d acc = _mm_setzero_pd();
+    for (size_t d = 0; d < n; ++d) {
+      __m128d diff = _mm_sub_pd(_mm_loadu_pd(block + d * count + r),
+                                _mm_set1_pd(q[d]));
+      acc = _mm_add_pd(acc, _mm_mul_pd(diff, diff));
+    }
+    _mm_storeu_pd(out + r, acc);
+  }
+  for (; r < count; ++r) {
+    double sum = 0.0;
+    for (size_t d = 0; d < n; ++d) {
+      double diff = block[d * count + r] - q[d];
+      sum += diff * diff;
+    }
+    out[r] = sum;
+  }
+}
+
+__attribute__((target("avx2,fma"))) inline double
+l2sqAvx2(const double *a, const double *b, size_t n) {
+  __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+    __m256d d1 =
+        _mm256_sub_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4));
+    acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+    acc1 = _mm256_fmadd_pd(d1, d1, acc1);
+  }
+  for (; i + 4 <= n; i += 4) {
+    __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+    acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+  }
+  acc0 = _mm256_add_pd(acc0, acc1);
+  __m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc0),
+                            _mm256_extractf128_pd(acc0, 1));
+  double sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+  for (; i < n; ++i) {
+    double diff = a[i] - b[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+__attribute__((target("avx2,fma"))) inline void
+l2sqBlockAvx2(const double *q, const double *block, size_t count, size_t n,
+              double *out) {
+  size_t r = 0;
+  for (; r + 4 <= count; r += 4) {
+    __m256d acc = _mm256_setzero_pd();
+    for (size_t d = 0; d < n; ++d) {
+      __m256d diff = _mm256_sub_pd(_mm256_loadu_pd(block + d * count + r),
+                                   _mm256_set1_pd(q[d]));
+      acc = _mm256_fmadd_pd(diff, diff, acc);
+    }
+    _mm256_storeu_pd(out + r, acc);
+  }
+  for (; r < count; ++r) {
+    double sum = 0.0;
+    for (size_t d = 0; d < n; ++d) {
+      double diff = block[d * count + r] - q[d];
+      sum += diff * diff;
+    }
+    out[r] = sum;
+  }
+}
+
+__attribute__((target("avx512f"))) inline double
+l2sqAvx512(const double *a, const double *b, size_t n) {
+  __m512d acc = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512d diff =
+        _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i));
+    acc = _mm512_fmadd_pd(diff, diff, acc);
+  }
+  if (i < n) {
+    __mmask8 mask = (__mmask8)((1u << (n - i)) - 1);
+    __m512d diff = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, a + i),
+                                 _mm512_maskz_loadu_pd(mask, b + i));
+    acc = _mm512_fmadd_pd(diff, diff, acc);
+  }
+  double lanes[8];
+  _mm512_storeu_pd(lanes, acc);
+  double sum = 0.0;
+  for (double lane : lanes)
+    sum += lane;
+  return sum;
+}
+
+__attribute__((target("avx512f"))) inline void
+l2sqBlockAvx512(const double *q, const double *block, size_t count, size_t n,
+                double *out) {
+  for (size_t r = 0; r < count; r += 8) {
+    __mmask8 mask =
+        count - r >= 8 ? (__mmask8)0xFF : (__mmask8)((1u << (count - r)) - 1);
+    __m512d acc = _mm512_setzero_pd();
+    for (size_t d = 0; d < n; ++d) {
+      __m512d diff =
+          _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, block + d * count + r),
+                        _mm512_set1_pd(q[d]));
+      acc = _mm512_fmadd_pd(diff, diff, acc);
+    }
+    _mm512_mask_storeu_pd(out + r, mask, acc);
+  }
+}
+
+#endif
+
+inline DistanceKernels resolveKernels() {
+  const DistanceKernels scalar{"scalar", l2sqScalar, l2sqBlockScalar};
+#ifdef SIMD_DISTANCE_X86
+  const DistanceKernels sse2{"sse2", l2sqSse2, l2sqBlockSse2};
+  const DistanceKernels avx2{"avx2", l2sqAvx2, l2sqBlockAvx2};
+  const DistanceKernels avx512{"avx512", l2sqAvx512, l2sqBlockAvx512};
+
+  __builtin_cpu_init();
+  bool hasSse2 = __builtin_cpu_supports("sse2");
+  bool hasAvx2 =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  bool hasAvx512 = __builtin_cpu_supports("avx512f");
+
+  if (const char *forced = std::getenv("SIMD_KERNEL")) {
+    std::string_view name(forced);
+    if (name == "scalar")
+      return scalar;
+    if (name == "sse2" && hasSse2)
+      return sse2;
+    if (name == "avx2" && hasAvx2)
+      return avx2;
+    if (name == "avx512" && hasAvx512)
+      return avx512;
+  }
+
+  if (hasAvx512)
+    return avx512;
+  if (hasAvx2)
+    return avx2;
+  if (hasSse2)
+    return sse2;
+#endif
+  return scalar;
+}
+
+} // namespace detail
+
+// Se resuelve una sola vez por proceso
+inline const DistanceKernels &kernels() {
+  static const DistanceKernels selected = detail::resolveKernels();
+  return selected;
+}
+
+inline double l2sq(const double *a, const double *b, size_t n) {
+  return kernels().l2sq(a, b, n);
+}
+
+inline double l2(const double *a, const double *b, size_t n) {
+  return std::sqrt(l2sq(a, b, n));
+}
+
+inline void l2sqBlock(const double *q, const double *block, size_t count,
+                      size_t n, double *out) {
+  kernels().l2sqBlock(q, block, count, n, out);
+}
+
+inline void l2Block(const double *q, const double *block, size_t count,
+                    size_t n, double *out) {
+  l2sqBlock(q, block, count, n, out);
+  for (size_t r = 0; r < count; ++r)
+    out[r] = std::sqrt(out[r]);
+}
+
+} // namespace simd
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+// splitmix64: estado de 64 bits, barato de sembrar. Cada subproblema del
+// build deriva su propio flujo de (semilla, i, j), así el árbol depende solo
+// de la semilla y no del orden en que los hilos ejecutan las tareas
+struct SplitMix64 {
+  using result_type = std::uint64_t;
+  std::uint64_t state;
+
+  SplitMix64(std::uint64_t seed, std::uint64_t i, std::uint64_t j)
+      : state(seed ^ (i * 0x9E3779B97F4A7C15ull) ^
+              (j * 0xC2B2AE3D27D4EB4Full)) {}
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return UINT64_MAX; }
+
+  result_type operator()() {
+    std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+};
@@ -45,13 +45,31 @@ void wait_until_close(const std::vector<std::string> &windows) {
 }
 
 int main() {
-  auto baseData = readCSV("dataset/images_dataset.csv", 20000, -1);
+  auto baseData = loadDataset("dataset/images_dataset.csv", 20000);
 
+  // El VP-tree se recarga del índice si corresponde a este dataset; así el
+  // árbol (y su poda) es el mismo entre ejecuciones
+  const std::string vp_index = "dataset/images_dataset.vpidx";
   VP_tree vp_tree(baseData);
-  vp_tree.build();
+  if (!vp_tree.load_index(vp_index)) {
+    vp_tree.set_build_threads(0);
+    vp_tree.build();
+    vp_tree.save_index(vp_index);
+  }
 
+  // El KD-tree se recarga del snapshot si corresponde a este dataset
+  const std::string kd_snapshot = "dataset/images_dataset.kdsnap";
   KDTree kd_tree;
-  kd_tree.build(baseData);
+  if (!kd_tree.loadSnapshot(kd_snapshot, baseData)) {
+    kd_tree.setBuildThreads(0);
+    kd_tree.build(baseData, KDLayout::Implicit);
+    kd_tree.saveSnapshot(kd_snapshot);
+  }
+
+  // Para explorar basta el kNN aproximado del KD-tree: epsilon relaja la
+  // poda y kd_max_checks acota las distancias (y la latencia) por consulta
+  constexpr double kd_epsilon = 0.5;
+  constexpr size_t kd_max_checks = 2000;
 
   while (true) {
     int id, k;
@@ -64,17 +82,19 @@ int main() {
     std::cout << "k vecinos: ";
     std::cin >> k;
 
-    auto it = std::find_if(baseData.begin(), baseData.end(),
-                           [&](auto &p) { return p.id == id; });
+    size_t row = baseData.rowOf(id);
 
-    if (it == baseData.end()) {
+    if (row == Dataset::npos) {
       std::cout << "ID no encontrado\n";
       continue;
     }
 
     double searchTime;
-    auto raw_kd = kd_tree.kNearestNeighbors({it->coords, it->id},
-                                            k, searchTime);
+    size_t kd_checks;
+    auto raw_kd = kd_tree.approxKNearestNeighbors(
+        baseData[row], k, kd_epsilon, kd_max_checks, kd_checks, searchTime);
+    std::cout << "KD-tree: " << kd_checks << " distancias, "
+              << searchTime / 1000.0 << " us\n";
 
     auto res_vp = vp_tree.knn(id, k);
 
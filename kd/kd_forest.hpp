@@ -0,0 +1,264 @@
+#pragma once
+
+#include <bit>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+#include "kd_tree.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// Cada árbol guarda su propia copia de las coordenadas, ordenada en bloques
+// SoA por hoja para el kernel de distancias, así el bosque ocupa unas
+// treeCount veces lo que un KDTree implícito (1M x 14 con 4 árboles: ~450 MB
+// frente a ~112 MB). estimatedMemoryBytes suma todas las copias.
+constexpr int KD_FOREST_DEFAULT_TREES = 4;
+
+// Bosque de KDTree implícitos sobre las mismas filas, al estilo de FLANN:
+// cada árbol elige el eje de cada nodo al azar entre los de mayor varianza
+// (KDSplitPolicy::RandomTopVariance), así las celdas se cortan distinto y un
+// vecino que un árbol deja al otro lado de un corte otro lo tiene cerca. La
+// búsqueda comparte entre todos los árboles una cola de ramas pendientes
+// (siempre la celda más cercana de cualquiera de ellos) y el conjunto de
+// filas ya evaluadas, así cada punto cuenta una sola vez aunque aparezca en
+// una hoja de cada árbol.
+template <size_t D = DYNAMIC_DIMS> class KDForest {
+  using Tree = KDTree<D>;
+
+  // Los árboles se construyen con el número de fila como id; ids lo
+  // traduce al id del dataset
+  vector<Tree> trees;
+  vector<int> ids;
+  int treeCount;
+  uint64_t seed;
+  unsigned buildThreads;
+
+  // Rama pendiente: cota de su celda, árbol, nodo y posición en la reserva
+  // de la copia de off con que se retoma
+  struct Pending {
+    double cellDistSq;
+    int tree;
+    size_t node;
+    size_t off;
+    bool operator>(const Pending &other) const {
+      return cellDistSq > other.cellDistSq;
+    }
+  };
+
+  // (distancia al cuadrado, árbol, posición en el árbol)
+  using Heap = priority_queue<tuple<double, int, size_t>>;
+
+  // Filas ya evaluadas por la consulta: tabla hash abierta (fila + 1, 0 =
+  // libre) con capacidad del orden de maxChecks, así el costo de empezar una
+  // consulta no depende del tamaño del dataset. Crece al pasar la mitad.
+  struct Visited {
+    vector<uint32_t> slots;
+    size_t used = 0;
+    int shift = 0;
+
+    void reset(size_t expected) {
+      size_t capacity = bit_ceil(max<size_t>(2 * expected, 64));
+      slots.assign(capacity, 0);
+      used = 0;
+      shift = 32 - countr_zero(capacity);
+    }
+    bool mark(int row) {
+      if (2 * (used + 1) > slots.size())
+        grow();
+      uint32_t key = uint32_t(row) + 1;
+      size_t mask = slots.size() - 1;
+      for (size_t j = (key * 2654435769u) >> shift;; j = (j + 1) & mask) {
+        if (slots[j] == key)
+          return false;
+        if (slots[j] == 0) {
+          slots[j] = key;
+          used++;
+          return true;
+        }
+      }
+    }
+
+  private:
+    void grow() {
+      vector<uint32_t> old = move(slots);
+      reset(old.size());
+      for (uint32_t key : old)
+        if (key)
+          mark(int(key - 1));
+    }
+  };
+
+  void search(const double *target, int k, size_t maxChecks, Heap &heap,
+              SearchStats &stats) const {
+    size_t dims = trees[0].dims();
+    size_t checked = stats.distanceCalls;
+    thread_local Visited visited;
+    visited.reset(maxChecks ? maxChecks : KD_MAX_LEAF_SIZE);
+    vector<double> offsets(dims, 0.0);
+    auto off = trees[0].cellOffsets();
+    priority_queue<Pending, vector<Pending>, greater<>> pending;
+    for (int t = 0; t < int(trees.size()); ++t)
+      pending.push({0.0, t, 0, 0});
+
+    auto worst = [&] { return get<0>(heap.top()); };
+
+    while (!pending.empty()) {
+      auto [cellDistSq, t, i, at] = pending.top();
+      pending.pop();
+      if (heap.size() == size_t(k) && cellDistSq >= worst())
+        break;
+
+      const Tree &tree = trees[t];
+      copy_n(offsets.begin() + at, dims, off.begin());
+
+      while (heap.size() < size_t(k) || cellDistSq < worst()) {
+        if (maxChecks && stats.distanceCalls - checked >= maxChecks) {
+          stats.truncatedQueries++;
+          return;
+        }
+
+        stats.visitedNodes++;
+        if (i >= tree.firstLeaf()) {
+          // El kernel calcula la hoja entera; las filas que ya vio otro
+          // árbol se descartan al mezclar y no cuentan como evaluadas
+          double dists[KD_MAX_LEAF_SIZE];
+          size_t leaf = i - tree.firstLeaf();
+          size_t start = tree.leafBegin(leaf);
+          size_t count = tree.leafDistances(leaf, target, dists);
+          for (size_t r = 0; r < count; ++r) {
+            if (!visited.mark(tree.flatIds[start + r]))
+              continue;
+            if (maxChecks && stats.distanceCalls - checked >= maxChecks) {
+              stats.truncatedQueries++;
+              return;
+            }
+            stats.distanceCalls++;
+
+            if (heap.size() < size_t(k)) {
+              heap.push({dists[r], t, start + r});
+            } else if (dists[r] < worst()) {
+              heap.pop();
+              heap.push({dists[r], t, start + r});
+            }
+          }
+          break;
+        }
+
+        int axis = tree.flatAxis[i];
+        double diff = target[axis] - tree.flatSplit[i];
+        size_t first = diff < 0 ? 2 * i + 1 : 2 * i + 2;
+        size_t second = diff < 0 ? 2 * i + 2 : 2 * i + 1;
+
+        double farDistSq = cellDistSq - off[axis] * off[axis] + diff * diff;
+        if (heap.size() < size_t(k) || farDistSq < worst()) {
+          size_t farOff = offsets.size();
+          offsets.insert(offsets.end(), off.begin(), off.end());
+          offsets[farOff + axis] = diff;
+          pending.push({farDistSq, t, second, farOff});
+        }
+        i = first;
+      }
+    }
+  }
+
+public:
+  double buildTimeUs;
+  size_t estimatedMemoryBytes;
+
+  explicit KDForest(int treeCount = KD_FOREST_DEFAULT_TREES)
+      : treeCount(max(treeCount, 1)), seed(0), buildThreads(1),
+        buildTimeUs(0), estimatedMemoryBytes(0) {}
+
+  // Como KDTree::build, los árboles copian las coordenadas (una copia por
+  // árbol, ver KD_FOREST_DEFAULT_TREES) y data puede liberarse después
+  void build(const DatasetView &data, int bucketSize = KD_DEFAULT_LEAF_SIZE) {
+    if (data.empty())
+      return;
+
+    if (D != DYNAMIC_DIMS && data.dims() < D) {
+      cerr << "Error: los puntos tienen " << data.dims()
+           << " dimensiones, el bosque espera " << D << endl;
+      return;
+    }
+
+    auto start = high_resolution_clock::now();
+
+    ids.resize(data.size());
+    vector<int> rowIds(data.size());
+    for (size_t r = 0; r < data.size(); ++r) {
+      ids[r] = data.id(r);
+      rowIds[r] = int(r);
+    }
+    DatasetView rows(data.row(0), data.size(), data.dims(), data.stride(),
+                     rowIds.data(), nullptr);
+
+    trees.clear();
+    trees.resize(treeCount);
+    estimatedMemoryBytes = ids.size() * sizeof(int);
+    for (int t = 0; t < treeCount; ++t) {
+      trees[t].setSplitPolicy(KDSplitPolicy::RandomTopVariance);
+      trees[t].setSeed(SplitMix64(seed, t, 0)());
+      trees[t].setBuildThreads(buildThreads);
+      trees[t].build(rows, KDLayout::Implicit, bucketSize);
+      estimatedMemoryBytes += trees[t].estimatedMemoryBytes;
+    }
+
+    auto end = high_resolution_clock::now();
+    buildTimeUs = duration_cast<nanoseconds>(end - start).count();
+  }
+
+  // kNN aproximado sobre todos los árboles a la vez; evalúa como mucho
+  // maxChecks puntos distintos (0 = sin límite, resultado exacto), aunque el
+  // límite caiga a mitad de una hoja, y checks devuelve los que se
+  // evaluaron. Con el límite puede devolver menos de k puntos.
+  vector<Point> kNearestNeighbors(const PointView &target, int k,
+                                  size_t maxChecks, size_t &checks,
+                                  double &searchTime,
+                                  SearchStats *stats = nullptr) const {
+    auto start = high_resolution_clock::now();
+
+    SearchStats local;
+    vector<Point> result;
+
+    if (k > 0 && !ids.empty()) {
+      Heap heap;
+      search(target.data(), k, maxChecks, heap, local);
+      while (!heap.empty()) {
+        auto [dist, t, pos] = heap.top();
+        Point p = trees[t].flatToPoint(pos);
+        p.id = ids[p.id];
+        result.push_back(move(p));
+        heap.pop();
+      }
+      reverse(result.begin(), result.end());
+    }
+
+    auto end = high_resolution_clock::now();
+    searchTime = duration_cast<nanoseconds>(end - start).count();
+    checks = local.distanceCalls;
+    if (stats) {
+      local.queries = 1;
+      local.searchTimeNs = searchTime;
+      *stats += local;
+    }
+
+    return result;
+  }
+
+  // Semilla de los ejes aleatorios; cada árbol deriva la suya
+  void setSeed(uint64_t value) { seed = value; }
+  // Hilos para el build de cada árbol; 0 usa todos los núcleos disponibles
+  void setBuildThreads(unsigned threads) {
+    buildThreads = resolveThreads(threads);
+  }
+
+  double getBuildTime() const { return buildTimeUs; }
+  int getTreeCount() const { return treeCount; }
+  int size() const { return ids.size(); }
+  int getDimensions() const { return trees.empty() ? 0 : trees[0].dims(); }
+};
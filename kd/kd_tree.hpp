@@ -3,169 +3,1155 @@
 #include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <numeric>
 #include <queue>
+#include <span>
+#include <string>
 #include <vector>
 
+#include "checksum.hpp"
+#include "dataset.hpp"
+#include "layout.hpp"
+#include "mapped_file.hpp"
+#include "node_arena.hpp"
+#include "parallel.hpp"
 #include "point.hpp"
+#include "search_stats.hpp"
+#include "split_mix.hpp"
 
 using namespace std;
 using namespace std::chrono;
 
-struct KDNode {
-  Point point;
+enum class KDLayout { Pointer, Implicit };
+
+// Elección del eje de corte en build(). Cycle alterna los ejes por nivel;
+// MaxSpread toma el de mayor rango y MaxVariance el de mayor varianza en una
+// muestra del subárbol. SlidingMidpoint corta el eje de mayor rango por su
+// punto medio (deslizado al primer punto por encima) en vez de por la
+// mediana: el árbol puede quedar desbalanceado. El layout implícito siempre
+// parte por la mediana y con SlidingMidpoint usa el eje de MaxSpread.
+// RandomTopVariance elige al azar (según setSeed) entre los
+// KD_RANDOM_TOP_AXES ejes de mayor varianza: árboles distintos para KDForest.
+enum class KDSplitPolicy {
+  Cycle,
+  MaxSpread,
+  MaxVariance,
+  SlidingMidpoint,
+  RandomTopVariance
+};
+
+constexpr int KD_DEFAULT_LEAF_SIZE = 16;
+constexpr int KD_MAX_LEAF_SIZE = 256;
+
+// Subárboles más pequeños se construyen en el hilo que los encuentra
+constexpr size_t KD_PARALLEL_CUTOFF = 4096;
+
+// Consultas que toma un hilo cada vez en knnBatch
+constexpr size_t KD_BATCH_GRAIN = 64;
+
+// Filas muestreadas (en media) por nodo para estimar la varianza
+// (MaxVariance y RandomTopVariance)
+constexpr size_t KD_VARIANCE_SAMPLE = 128;
+constexpr size_t KD_RANDOM_TOP_AXES = 5;
+
+// Snapshot del layout implícito (versión 1), en el orden de bytes de la
+// máquina: cabecera y secciones split, axis, coords e ids alineadas a
+// DATASET_ALIGNMENT. checksum cubre las cuatro secciones; fingerprint es la
+// huella del DatasetView con que se construyó el árbol.
+constexpr char KD_SNAPSHOT_MAGIC[8] = {'K', 'D', 'S', 'N', 'A', 'P', '\0',
+                                       '\0'};
+constexpr uint32_t KD_SNAPSHOT_VERSION = 1;
+
+struct KDSnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dims;
+  uint64_t size;
+  uint32_t leafSize;
+  uint32_t leafLevels;
+  uint64_t fingerprint;
+  uint64_t checksum;
+  uint64_t splitOffset;
+  uint64_t axisOffset;
+  uint64_t coordsOffset;
+  uint64_t idsOffset;
+};
+
+// Con D fija las coordenadas van dentro del nodo; con DYNAMIC_DIMS en un
+// tramo de la NodeArena<double> del árbol. Así el nodo es trivial de
+// destruir en ambos casos y la arena lo libera todo sin recorrer nodos.
+template <size_t D>
+using KDNodeCoords =
+    conditional_t<D == DYNAMIC_DIMS, span<double>, array<double, D>>;
+
+template <size_t D> struct KDNode {
+  KDNodeCoords<D> coords;
+  int id;
   int axis;
-  unique_ptr<KDNode> left;
-  unique_ptr<KDNode> right;
+  // Los nodos viven en la NodeArena del árbol
+  KDNode *left;
+  KDNode *right;
+
+  KDNode(const PointView &p, int a)
+    requires(D != DYNAMIC_DIMS)
+      : coords(makeCoords<D>(p.data(), p.size())), id(p.id), axis(a),
+        left(nullptr), right(nullptr) {}
+
+  // slot: dims doubles sin usar de la arena de coordenadas
+  KDNode(const PointView &p, int a, double *slot, size_t dims)
+    requires(D == DYNAMIC_DIMS)
+      : coords(slot, dims), id(p.id), axis(a), left(nullptr),
+        right(nullptr) {
+    size_t n = min(p.size(), dims);
+    copy_n(p.data(), n, slot);
+    fill(slot + n, slot + dims, 0.0);
+  }
 
-  KDNode(const Point &p, int a)
-      : point(p), axis(a), left(nullptr), right(nullptr) {}
+  double operator[](size_t i) const { return coords[i]; }
+  Point toPoint() const {
+    return Point(vector<double>(coords.begin(), coords.end()), id);
+  }
 };
 
-class KDTree {
+// D fija la dimensión en compilación (ver dispatchDims); con DYNAMIC_DIMS se
+// toma de los datos al construir
+template <size_t D> class KDForest;
+
+template <size_t D = DYNAMIC_DIMS> class KDTree {
 private:
-  unique_ptr<KDNode> root;
+  // El bosque recorre los árboles implícitos con una cola compartida
+  friend class KDForest<D>;
+
+  using KDNode = ::KDNode<D>;
+
+  // Layout de punteros: nodos en preorden dentro de la arena (el build
+  // reserva todos de una vez); insertPoint añade al final
+  NodeArena<KDNode> arena;
+  // Coordenadas de los nodos con DYNAMIC_DIMS: el build las reserva en el
+  // mismo preorden que los nodos (ver nodeBase)
+  NodeArena<double> coordArena;
+  double *coordBase = nullptr;
+  KDNode *root;
   int dimensions;
   int treeSize;
+  KDLayout layout;
+  KDSplitPolicy splitPolicy;
+  uint64_t seed;
+  unsigned buildThreads;
 
+  // Disposición implícita: árbol perfecto de leafLevels niveles internos,
+  // nodo i con hijos en 2i+1 y 2i+2. Los nodos internos guardan solo el
+  // plano de corte; las hojas son buckets de hasta leafSize puntos cuyas
+  // coordenadas se guardan como bloque SoA (flatCoords[lo * D + d * n + r]).
+  // Las búsquedas leen los spans flat*, que apuntan a los vectores propios
+  // tras build() o al archivo proyectado tras loadSnapshot().
+  int leafSize;
+  int leafLevels;
+  vector<double> splitStorage;
+  vector<int> axisStorage;
+  vector<double> coordsStorage;
+  vector<int> idsStorage;
+  MappedFile snapshot;
+  span<const double> flatSplit;
+  span<const int> flatAxis;
+  span<const double> flatCoords;
+  span<const int> flatIds;
+  uint64_t dataFingerprint = 0;
+
+  // Cajas ajustadas opcionales (setTightBounds): por nodo, mínimos y máximos
+  // de los puntos de su subárbol en boxStorage[pos * 2 * dims()]. pos es el
+  // índice por niveles en el layout implícito y la posición en preorden
+  // (node - nodeBase, el primer nodo del build) en el de punteros. Vacío si
+  // no se pidieron, tras loadSnapshot o tras insertPoint.
+  bool tightBounds;
+  vector<double> boxStorage;
+  const KDNode *nodeBase = nullptr;
+
+  size_t dims() const {
+    if constexpr (D != DYNAMIC_DIMS)
+      return D;
+    return dimensions;
+  }
+
+  // Distancia por eje de la consulta a la celda que se recorre; empieza en
+  // cero (la raíz cubre todo el espacio)
+  CoordStorage<D> cellOffsets() const {
+    CoordStorage<D> off{};
+    if constexpr (D == DYNAMIC_DIMS)
+      off.assign(dims(), 0.0);
+    return off;
+  }
+
+  double *boxLo(size_t pos) { return boxStorage.data() + pos * 2 * dims(); }
+  double *boxHi(size_t pos) { return boxLo(pos) + dims(); }
+
+  void resetBoxes(size_t nodes) {
+    boxStorage.resize(nodes * 2 * dims());
+    for (size_t pos = 0; pos < nodes; ++pos) {
+      fill_n(boxLo(pos), dims(), numeric_limits<double>::infinity());
+      fill_n(boxHi(pos), dims(), -numeric_limits<double>::infinity());
+    }
+  }
+
+  void growBox(size_t pos, const double *lo, const double *hi) {
+    double *boxMin = boxLo(pos);
+    double *boxMax = boxHi(pos);
+    for (size_t d = 0; d < dims(); ++d) {
+      boxMin[d] = min(boxMin[d], lo[d]);
+      boxMax[d] = max(boxMax[d], hi[d]);
+    }
+  }
+
+  double boxDistSq(size_t pos, const double *target) const {
+    const double *lo = boxStorage.data() + pos * 2 * dims();
+    const double *hi = lo + dims();
+    double dist = 0.0;
+    for (size_t d = 0; d < dims(); ++d) {
+      double e = max({lo[d] - target[d], target[d] - hi[d], 0.0});
+      dist += e * e;
+    }
+    return dist;
+  }
+
+  // ¿Puede el subárbol pos tener puntos a distancia menor que bound? Primero
+  // la cota incremental de la celda (gratis) y, si hay cajas, la de la caja
+  bool reachable(size_t pos, const double *target, double cellDistSq,
+                 double bound) const {
+    return cellDistSq < bound &&
+           (boxStorage.empty() || boxDistSq(pos, target) < bound);
+  }
+  bool reachable(const KDNode *node, const double *target, double cellDistSq,
+                 double bound) const {
+    return cellDistSq < bound &&
+           (boxStorage.empty() || boxDistSq(node - nodeBase, target) < bound);
+  }
+
+  // Rama pendiente de la búsqueda aproximada: cota de su celda, nodo y
+  // posición en la reserva de la copia de off con que se retoma
+  template <class Ref> struct Pending {
+    double cellDistSq;
+    Ref node;
+    size_t off;
+    bool operator>(const Pending &other) const {
+      return cellDistSq > other.cellDistSq;
+    }
+  };
+  template <class Ref>
+  using PendingQueue =
+      priority_queue<Pending<Ref>, vector<Pending<Ref>>, greater<>>;
+
+  // Ordena filas del Dataset por su coordenada en axis; el build mueve
+  // índices de fila, no coordenadas
+  // Orden (coordenada, fila): con valores repetidos en el eje el
+  // nth_element en paralelo y en serie eligen la misma mediana y reparten
+  // las mismas filas a cada lado
   struct AxisComparator {
+    const DatasetView *data;
     int axis;
-    AxisComparator(int a) : axis(a) {}
-    bool operator()(const Point &a, const Point &b) const {
-      return a.coords[axis] < b.coords[axis];
+    AxisComparator(const DatasetView &d, int a) : data(&d), axis(a) {}
+    bool operator()(size_t a, size_t b) const {
+      double ca = data->row(a)[axis], cb = data->row(b)[axis];
+      return ca < cb || (ca == cb && a < b);
     }
   };
 
-  unique_ptr<KDNode> buildTree(vector<Point> &points, int depth, int start,
-                               int end) {
+  // Eje de mayor rango entre las filas [start, end); lo y hi son su mínimo y
+  // su máximo
+  int maxSpreadAxis(const DatasetView &data, const vector<size_t> &rows,
+                    size_t start, size_t end, double &lo, double &hi) const {
+    vector<double> lows(data.row(rows[start]), data.row(rows[start]) + dims());
+    vector<double> highs = lows;
+    for (size_t i = start + 1; i < end; ++i) {
+      const double *coords = data.row(rows[i]);
+      for (size_t d = 0; d < dims(); ++d) {
+        lows[d] = min(lows[d], coords[d]);
+        highs[d] = max(highs[d], coords[d]);
+      }
+    }
+
+    int axis = 0;
+    for (size_t d = 1; d < dims(); ++d)
+      if (highs[d] - lows[d] > highs[axis] - lows[axis])
+        axis = d;
+    lo = lows[axis];
+    hi = highs[axis];
+    return axis;
+  }
+
+  // Varianza por eje en una muestra de unas KD_VARIANCE_SAMPLE filas de
+  // [start, end). La muestra son las filas con hash bajo, sumadas en orden
+  // de fila: no depende de cómo dejó el rango el nth_element (en paralelo
+  // lo deja distinto que en serie), así el árbol tampoco.
+  vector<double> sampleVariances(const DatasetView &data,
+                                 const vector<size_t> &rows, size_t start,
+                                 size_t end) const {
+    size_t count = end - start;
+    vector<size_t> sample;
+    if (count <= KD_VARIANCE_SAMPLE) {
+      sample.assign(rows.begin() + start, rows.begin() + end);
+    } else {
+      uint64_t limit = UINT64_MAX / count * KD_VARIANCE_SAMPLE;
+      for (size_t i = start; i < end; ++i)
+        if (SplitMix64(rows[i], 0, 0)() <= limit)
+          sample.push_back(rows[i]);
+      if (sample.empty())
+        sample.push_back(*min_element(rows.begin() + start,
+                                      rows.begin() + end));
+    }
+    sort(sample.begin(), sample.end());
+
+    vector<double> sum(dims(), 0.0), sumSq(dims(), 0.0);
+    for (size_t row : sample) {
+      const double *coords = data.row(row);
+      for (size_t d = 0; d < dims(); ++d) {
+        sum[d] += coords[d];
+        sumSq[d] += coords[d] * coords[d];
+      }
+    }
+
+    for (size_t d = 0; d < dims(); ++d) {
+      double mean = sum[d] / sample.size();
+      sum[d] = sumSq[d] / sample.size() - mean * mean;
+    }
+    return sum;
+  }
+
+  int maxVarianceAxis(const DatasetView &data, const vector<size_t> &rows,
+                      size_t start, size_t end) const {
+    auto variances = sampleVariances(data, rows, start, end);
+    return max_element(variances.begin(), variances.end()) -
+           variances.begin();
+  }
+
+  // El azar de cada nodo sale de (seed, start, end): el árbol depende solo
+  // de la semilla, no del reparto entre hilos
+  int randomTopVarianceAxis(const DatasetView &data,
+                            const vector<size_t> &rows, size_t start,
+                            size_t end) const {
+    auto variances = sampleVariances(data, rows, start, end);
+    vector<int> axes(dims());
+    iota(axes.begin(), axes.end(), 0);
+    size_t top = min(KD_RANDOM_TOP_AXES, dims());
+    partial_sort(axes.begin(), axes.begin() + top, axes.end(),
+                 [&](int a, int b) { return variances[a] > variances[b]; });
+    return axes[SplitMix64(seed, start, end)() % top];
+  }
+
+  // Eje de corte de [start, end) según splitPolicy; lo y hi quedan con el
+  // rango del eje si la política lo calcula (si no, lo == hi)
+  int splitAxis(const DatasetView &data, const vector<size_t> &rows,
+                size_t start, size_t end, int depth, double &lo,
+                double &hi) const {
+    lo = hi = 0.0;
+    switch (splitPolicy) {
+    case KDSplitPolicy::MaxSpread:
+    case KDSplitPolicy::SlidingMidpoint:
+      return maxSpreadAxis(data, rows, start, end, lo, hi);
+    case KDSplitPolicy::MaxVariance:
+      return maxVarianceAxis(data, rows, start, end);
+    case KDSplitPolicy::RandomTopVariance:
+      return randomTopVarianceAxis(data, rows, start, end);
+    default:
+      return depth % dimensions;
+    }
+  }
+
+  // Punto medio deslizante: el nodo es el punto con la menor coordenada >=
+  // (lo + hi) / 2 en axis, a su izquierda quedan las menores. Devuelve su
+  // posición en rows.
+  size_t slideToMidpoint(const DatasetView &data, vector<size_t> &rows,
+                         size_t start, size_t end, int axis, double lo,
+                         double hi) const {
+    double cut = lo + (hi - lo) / 2;
+    auto first = rows.begin() + start;
+    auto last = rows.begin() + end;
+    auto upper = partition(first, last, [&](size_t r) {
+      return data.row(r)[axis] < cut;
+    });
+    iter_swap(upper, min_element(upper, last, AxisComparator(data, axis)));
+    return upper - rows.begin();
+  }
+
+  // Los subárboles son independientes tras nth_element: con threads > 1 el
+  // izquierdo se construye en otra tarea y el presupuesto de hilos se reparte.
+  // Cada subárbol ocupa un tramo propio de slots, así las tareas no se
+  // sincronizan y el resultado es el mismo preorden que en serie.
+  KDNode *buildTree(const DatasetView &data, vector<size_t> &rows, int depth,
+                    int start, int end, unsigned threads,
+                    typename NodeArena<KDNode>::Slots &slots) {
     if (start >= end)
       return nullptr;
 
-    int axis = depth % dimensions;
+    double lo, hi;
+    int axis = splitAxis(data, rows, start, end, depth, lo, hi);
     int mid = start + (end - start) / 2;
 
-    nth_element(points.begin() + start, points.begin() + mid,
-                points.begin() + end, AxisComparator(axis));
+    // Sin rango (todos iguales en el eje) el punto medio no separa nada y
+    // se parte por la mediana
+    if (splitPolicy == KDSplitPolicy::SlidingMidpoint && lo < hi)
+      mid = slideToMidpoint(data, rows, start, end, axis, lo, hi);
+    else
+      parallelNthElement(rows.begin() + start, rows.begin() + mid,
+                         rows.begin() + end, AxisComparator(data, axis),
+                         threads);
+
+    KDNode *node;
+    if constexpr (D == DYNAMIC_DIMS)
+      node = slots.make(data[rows[mid]], axis,
+                        coordBase + (slots.next - nodeBase) * dims(), dims());
+    else
+      node = slots.make(data[rows[mid]], axis);
+
+    if (threads > 1 && size_t(end - start) > KD_PARALLEL_CUTOFF) {
+      auto leftSlots = slots.split(mid - start);
+      auto left = async(launch::async, [&, threads] {
+        return buildTree(data, rows, depth + 1, start, mid, threads / 2,
+                         leftSlots);
+      });
+      node->right = buildTree(data, rows, depth + 1, mid + 1, end,
+                              threads - threads / 2, slots);
+      node->left = left.get();
+    } else {
+      node->left = buildTree(data, rows, depth + 1, start, mid, 1, slots);
+      node->right = buildTree(data, rows, depth + 1, mid + 1, end, 1, slots);
+    }
 
-    auto node = make_unique<KDNode>(points[mid], axis);
-    node->left = buildTree(points, depth + 1, start, mid);
-    node->right = buildTree(points, depth + 1, mid + 1, end);
+    if (!boxStorage.empty()) {
+      size_t pos = node - nodeBase;
+      growBox(pos, node->coords.data(), node->coords.data());
+      for (const KDNode *child : {node->left, node->right})
+        if (child)
+          growBox(pos, boxLo(child - nodeBase), boxHi(child - nodeBase));
+    }
 
     return node;
   }
 
-  void nearestNeighbor(const KDNode *node, const Point &target,
-                       const KDNode *&best, double &bestDist) const {
+  size_t firstLeaf() const { return (size_t{1} << leafLevels) - 1; }
+
+  size_t leafBegin(size_t leaf) const {
+    return implicitRangeBegin(treeSize, leafLevels, leaf);
+  }
+
+  void buildImplicit(const DatasetView &data, vector<size_t> &rows, size_t pos,
+                     int level, unsigned threads) {
+    size_t q = pos + 1 - (size_t{1} << level);
+    size_t start = implicitRangeBegin(treeSize, level, q);
+    size_t end = implicitRangeBegin(treeSize, level, q + 1);
+
+    if (level == leafLevels) {
+      // El nth_element deja el bucket en un orden que depende de los hilos
+      sort(rows.begin() + start, rows.begin() + end);
+      size_t count = end - start;
+      double *block = coordsStorage.data() + start * dims();
+      for (size_t r = 0; r < count; ++r) {
+        const double *coords = data.row(rows[start + r]);
+        for (size_t d = 0; d < dims(); ++d)
+          block[d * count + r] = coords[d];
+        idsStorage[start + r] = data.id(rows[start + r]);
+        if (!boxStorage.empty())
+          growBox(pos, coords, coords);
+      }
+      return;
+    }
+
+    double lo, hi;
+    int axis = start < end ? splitAxis(data, rows, start, end, level, lo, hi)
+                           : level % dimensions;
+    size_t mid = implicitRangeBegin(treeSize, level + 1, 2 * q + 1);
+
+    if (mid < end) {
+      parallelNthElement(rows.begin() + start, rows.begin() + mid,
+                         rows.begin() + end, AxisComparator(data, axis),
+                         threads);
+      splitStorage[pos] = data.row(rows[mid])[axis];
+    } else if (start < end) {
+      splitStorage[pos] = data.row(*max_element(rows.begin() + start,
+                                             rows.begin() + end,
+                                             AxisComparator(data, axis)))[axis];
+    }
+    axisStorage[pos] = axis;
+
+    if (threads > 1 && end - start > KD_PARALLEL_CUTOFF) {
+      auto left = async(launch::async, [&, threads] {
+        buildImplicit(data, rows, 2 * pos + 1, level + 1, threads / 2);
+      });
+      buildImplicit(data, rows, 2 * pos + 2, level + 1,
+                    threads - threads / 2);
+      left.get();
+    } else {
+      buildImplicit(data, rows, 2 * pos + 1, level + 1, 1);
+      buildImplicit(data, rows, 2 * pos + 2, level + 1, 1);
+    }
+
+    if (!boxStorage.empty())
+      for (size_t child : {2 * pos + 1, 2 * pos + 2})
+        growBox(pos, boxLo(child), boxHi(child));
+  }
+
+  // Distancias al cuadrado del objetivo a todos los puntos de la hoja
+  // (kernel SIMD sobre el bloque SoA)
+  size_t leafDistances(size_t leaf, const double *target, double *out) const {
+    size_t start = leafBegin(leaf);
+    size_t count = leafBegin(leaf + 1) - start;
+    simd::l2sqBlock(target, flatCoords.data() + start * dims(), count, dims(),
+                    out);
+    return count;
+  }
+
+  Point flatToPoint(size_t row) const {
+    size_t leaf = (row << leafLevels) / treeSize;
+    while (leafBegin(leaf + 1) <= row)
+      ++leaf;
+    while (leafBegin(leaf) > row)
+      --leaf;
+
+    size_t start = leafBegin(leaf);
+    size_t count = leafBegin(leaf + 1) - start;
+    const double *block = flatCoords.data() + start * dims();
+
+    vector<double> coords(dims());
+    for (size_t d = 0; d < dims(); ++d)
+      coords[d] = block[d * count + (row - start)];
+    return Point(coords, flatIds[row]);
+  }
+
+  // Las búsquedas podan con la distancia incremental a la celda (Arya y
+  // Mount): off guarda la distancia por eje a la celda actual y cellDistSq
+  // su suma de cuadrados. La celda del hijo lejano solo cambia en el eje de
+  // corte, así su cota se actualiza en O(1) y tiene en cuenta todos los
+  // cortes anteriores, no solo el último.
+  void nearestNeighbor(size_t i, const double *target, size_t &best,
+                       double &bestDistSq, double *off, double cellDistSq,
+                       SearchStats &stats) const {
+    stats.visitedNodes++;
+    if (i >= firstLeaf()) {
+      double dists[KD_MAX_LEAF_SIZE];
+      size_t leaf = i - firstLeaf();
+      size_t start = leafBegin(leaf);
+      size_t count = leafDistances(leaf, target, dists);
+      stats.distanceCalls += count;
+      for (size_t r = 0; r < count; ++r) {
+        if (dists[r] < bestDistSq) {
+          bestDistSq = dists[r];
+          best = start + r;
+        }
+      }
+      return;
+    }
+
+    int axis = flatAxis[i];
+    double diff = target[axis] - flatSplit[i];
+
+    size_t first = diff < 0 ? 2 * i + 1 : 2 * i + 2;
+    size_t second = diff < 0 ? 2 * i + 2 : 2 * i + 1;
+
+    nearestNeighbor(first, target, best, bestDistSq, off, cellDistSq, stats);
+
+    double saved = off[axis];
+    double farDistSq = cellDistSq - saved * saved + diff * diff;
+    if (reachable(second, target, farDistSq, bestDistSq)) {
+      off[axis] = diff;
+      nearestNeighbor(second, target, best, bestDistSq, off, farDistSq,
+                      stats);
+      off[axis] = saved;
+    }
+  }
+
+  void kNearestNeighbors(size_t i, const double *target, int k,
+                         priority_queue<pair<double, size_t>> &heap,
+                         double *off, double cellDistSq,
+                         SearchStats &stats) const {
+    stats.visitedNodes++;
+    if (i >= firstLeaf()) {
+      double dists[KD_MAX_LEAF_SIZE];
+      size_t leaf = i - firstLeaf();
+      size_t start = leafBegin(leaf);
+      size_t count = leafDistances(leaf, target, dists);
+      stats.distanceCalls += count;
+      for (size_t r = 0; r < count; ++r) {
+        if (heap.size() < size_t(k)) {
+          heap.push({dists[r], start + r});
+        } else if (dists[r] < heap.top().first) {
+          heap.pop();
+          heap.push({dists[r], start + r});
+        }
+      }
+      return;
+    }
+
+    int axis = flatAxis[i];
+    double diff = target[axis] - flatSplit[i];
+
+    size_t first = diff < 0 ? 2 * i + 1 : 2 * i + 2;
+    size_t second = diff < 0 ? 2 * i + 2 : 2 * i + 1;
+
+    kNearestNeighbors(first, target, k, heap, off, cellDistSq, stats);
+
+    double saved = off[axis];
+    double farDistSq = cellDistSq - saved * saved + diff * diff;
+    if (heap.size() < size_t(k) ||
+        reachable(second, target, farDistSq, heap.top().first)) {
+      off[axis] = diff;
+      kNearestNeighbors(second, target, k, heap, off, farDistSq, stats);
+      off[axis] = saved;
+    }
+  }
+
+  void nearestNeighbor(const KDNode *node, const double *target,
+                       const KDNode *&best, double &bestDistSq, double *off,
+                       double cellDistSq, SearchStats &stats) const {
     if (!node)
       return;
 
-    double dist = node->point.distance(target);
-    if (dist < bestDist) {
-      bestDist = dist;
+    stats.visitedNodes++;
+    stats.distanceCalls++;
+
+    double dist =
+        squaredDistance<D>(node->coords.data(), target, dims());
+    if (dist < bestDistSq) {
+      bestDistSq = dist;
       best = node;
     }
 
     int axis = node->axis;
-    double diff = target[axis] - node->point[axis];
+    double diff = target[axis] - (*node)[axis];
 
-    const KDNode *first = diff < 0 ? node->left.get() : node->right.get();
-    const KDNode *second = diff < 0 ? node->right.get() : node->left.get();
+    const KDNode *first = diff < 0 ? node->left : node->right;
+    const KDNode *second = diff < 0 ? node->right : node->left;
 
-    nearestNeighbor(first, target, best, bestDist);
+    nearestNeighbor(first, target, best, bestDistSq, off, cellDistSq, stats);
 
-    if (fabs(diff) < bestDist) {
-      nearestNeighbor(second, target, best, bestDist);
+    double saved = off[axis];
+    double farDistSq = cellDistSq - saved * saved + diff * diff;
+    if (second && reachable(second, target, farDistSq, bestDistSq)) {
+      off[axis] = diff;
+      nearestNeighbor(second, target, best, bestDistSq, off, farDistSq,
+                      stats);
+      off[axis] = saved;
     }
   }
 
   void
-  kNearestNeighbors(const KDNode *node, const Point &target, int k,
-                    priority_queue<pair<double, const Point *>> &heap) const {
+  kNearestNeighbors(const KDNode *node, const double *target, int k,
+                    priority_queue<pair<double, const KDNode *>> &heap,
+                    double *off, double cellDistSq,
+                    SearchStats &stats) const {
     if (!node)
       return;
 
-    double dist = node->point.distance(target);
+    stats.visitedNodes++;
+    stats.distanceCalls++;
+
+    double dist =
+        squaredDistance<D>(node->coords.data(), target, dims());
 
-    if (heap.size() < k) {
-      heap.push({dist, &node->point});
+    if (heap.size() < size_t(k)) {
+      heap.push({dist, node});
     } else if (dist < heap.top().first) {
       heap.pop();
-      heap.push({dist, &node->point});
+      heap.push({dist, node});
     }
 
     int axis = node->axis;
-    double diff = target[axis] - node->point[axis];
+    double diff = target[axis] - (*node)[axis];
+
+    const KDNode *first = diff < 0 ? node->left : node->right;
+    const KDNode *second = diff < 0 ? node->right : node->left;
+
+    kNearestNeighbors(first, target, k, heap, off, cellDistSq, stats);
+
+    double saved = off[axis];
+    double farDistSq = cellDistSq - saved * saved + diff * diff;
+    if (second && (heap.size() < size_t(k) ||
+                   reachable(second, target, farDistSq, heap.top().first))) {
+      off[axis] = diff;
+      kNearestNeighbors(second, target, k, heap, off, farDistSq, stats);
+      off[axis] = saved;
+    }
+  }
 
-    const KDNode *first = diff < 0 ? node->left.get() : node->right.get();
-    const KDNode *second = diff < 0 ? node->right.get() : node->left.get();
+  // Best-bin-first aproximado: saca de pending la rama con la celda más
+  // cercana y baja por el lado de la consulta encolando los otros hijos con
+  // su cota incremental. Una rama solo se visita si su cota, multiplicada
+  // por scale = (1 + epsilon)^2, mejora el k-ésimo vecino. Deja de empezar
+  // nodos al llegar a maxChecks distancias (0 = sin límite).
+  void approxKNearestNeighbors(size_t root, const double *target, int k,
+                               double scale, size_t maxChecks,
+                               priority_queue<pair<double, size_t>> &heap,
+                               SearchStats &stats) const {
+    size_t checked = stats.distanceCalls;
+    vector<double> offsets(dims(), 0.0);
+    auto off = cellOffsets();
+    PendingQueue<size_t> pending;
+    pending.push({0.0, root, 0});
 
-    kNearestNeighbors(first, target, k, heap);
+    while (!pending.empty()) {
+      auto [cellDistSq, i, at] = pending.top();
+      pending.pop();
+      copy_n(offsets.begin() + at, dims(), off.begin());
 
-    if (heap.size() < k || fabs(diff) < heap.top().first) {
-      kNearestNeighbors(second, target, k, heap);
+      while (heap.size() < size_t(k) || cellDistSq * scale < heap.top().first) {
+        if (maxChecks && stats.distanceCalls - checked >= maxChecks) {
+          stats.truncatedQueries++;
+          return;
+        }
+
+        stats.visitedNodes++;
+        if (i >= firstLeaf()) {
+          double dists[KD_MAX_LEAF_SIZE];
+          size_t leaf = i - firstLeaf();
+          size_t start = leafBegin(leaf);
+          size_t count = leafDistances(leaf, target, dists);
+          stats.distanceCalls += count;
+          for (size_t r = 0; r < count; ++r) {
+            if (heap.size() < size_t(k)) {
+              heap.push({dists[r], start + r});
+            } else if (dists[r] < heap.top().first) {
+              heap.pop();
+              heap.push({dists[r], start + r});
+            }
+          }
+          break;
+        }
+
+        int axis = flatAxis[i];
+        double diff = target[axis] - flatSplit[i];
+        size_t first = diff < 0 ? 2 * i + 1 : 2 * i + 2;
+        size_t second = diff < 0 ? 2 * i + 2 : 2 * i + 1;
+
+        double farDistSq = cellDistSq - off[axis] * off[axis] + diff * diff;
+        if (heap.size() < size_t(k) ||
+            reachable(second, target, farDistSq, heap.top().first / scale)) {
+          size_t farOff = offsets.size();
+          offsets.insert(offsets.end(), off.begin(), off.end());
+          offsets[farOff + axis] = diff;
+          pending.push({farDistSq, second, farOff});
+        }
+        i = first;
+      }
+
+      if (heap.size() == size_t(k) && cellDistSq * scale >= heap.top().first)
+        break;
     }
   }
 
-  void insert(unique_ptr<KDNode> &node, const Point &point, int depth) {
+  void
+  approxKNearestNeighbors(const KDNode *root, const double *target, int k,
+                          double scale, size_t maxChecks,
+                          priority_queue<pair<double, const KDNode *>> &heap,
+                          SearchStats &stats) const {
+    if (!root)
+      return;
+
+    size_t checked = stats.distanceCalls;
+    vector<double> offsets(dims(), 0.0);
+    auto off = cellOffsets();
+    PendingQueue<const KDNode *> pending;
+    pending.push({0.0, root, 0});
+
+    while (!pending.empty()) {
+      auto [cellDistSq, node, at] = pending.top();
+      pending.pop();
+      copy_n(offsets.begin() + at, dims(), off.begin());
+
+      while (node && (heap.size() < size_t(k) ||
+                      cellDistSq * scale < heap.top().first)) {
+        if (maxChecks && stats.distanceCalls - checked >= maxChecks) {
+          stats.truncatedQueries++;
+          return;
+        }
+
+        stats.visitedNodes++;
+        stats.distanceCalls++;
+
+        double dist = squaredDistance<D>(node->coords.data(), target, dims());
+        if (heap.size() < size_t(k)) {
+          heap.push({dist, node});
+        } else if (dist < heap.top().first) {
+          heap.pop();
+          heap.push({dist, node});
+        }
+
+        int axis = node->axis;
+        double diff = target[axis] - (*node)[axis];
+        const KDNode *first = diff < 0 ? node->left : node->right;
+        const KDNode *second = diff < 0 ? node->right : node->left;
+
+        double farDistSq = cellDistSq - off[axis] * off[axis] + diff * diff;
+        if (second &&
+            (heap.size() < size_t(k) ||
+             reachable(second, target, farDistSq, heap.top().first / scale))) {
+          size_t farOff = offsets.size();
+          offsets.insert(offsets.end(), off.begin(), off.end());
+          offsets[farOff + axis] = diff;
+          pending.push({farDistSq, second, farOff});
+        }
+        node = first;
+      }
+
+      if (heap.size() == size_t(k) && cellDistSq * scale >= heap.top().first)
+        break;
+    }
+  }
+
+  void insert(KDNode *&node, const PointView &point, int depth) {
     if (!node) {
-      node = make_unique<KDNode>(point, depth % dimensions);
+      if constexpr (D == DYNAMIC_DIMS)
+        node = arena.make(point, depth % dimensions,
+                          coordArena.append(dims()).next, dims());
+      else
+        node = arena.make(point, depth % dimensions);
       treeSize++;
       return;
     }
 
     int axis = node->axis;
-    if (point[axis] < node->point[axis]) {
+    if (point[axis] < (*node)[axis]) {
       insert(node->left, point, depth + 1);
     } else {
       insert(node->right, point, depth + 1);
     }
   }
 
+  // Escribe los k vecinos de target (ordenados por distancia) en ids/dists;
+  // si el árbol tiene menos de k puntos se rellena con -1 / infinito
+  void knnInto(const double *target, int k, int *ids, double *dists,
+               SearchStats &stats) const {
+    size_t found = 0;
+    auto off = cellOffsets();
+
+    if (layout == KDLayout::Implicit) {
+      priority_queue<pair<double, size_t>> heap;
+      kNearestNeighbors(size_t{0}, target, k, heap, off.data(), 0.0, stats);
+      found = heap.size();
+      for (size_t i = found; i-- > 0; heap.pop()) {
+        ids[i] = flatIds[heap.top().second];
+        dists[i] = sqrt(heap.top().first);
+      }
+    } else {
+      priority_queue<pair<double, const KDNode *>> heap;
+      kNearestNeighbors(root, target, k, heap, off.data(), 0.0, stats);
+      found = heap.size();
+      for (size_t i = found; i-- > 0; heap.pop()) {
+        ids[i] = heap.top().second->id;
+        dists[i] = sqrt(heap.top().first);
+      }
+    }
+
+    for (size_t i = found; i < size_t(k); ++i) {
+      ids[i] = -1;
+      dists[i] = numeric_limits<double>::infinity();
+    }
+  }
+
   int calculateDepth(const KDNode *node) const {
     if (!node)
       return 0;
-    return 1 + max(calculateDepth(node->left.get()),
-                   calculateDepth(node->right.get()));
+    return 1 + max(calculateDepth(node->left),
+                   calculateDepth(node->right));
   }
 
 public:
   double buildTimeUs;
   double totalInsertionTimeUs;
-  double totalSearchTimeUs;
   size_t estimatedMemoryBytes;
 
   KDTree()
-      : root(nullptr), dimensions(0), treeSize(0), buildTimeUs(0),
-        totalInsertionTimeUs(0), totalSearchTimeUs(0), estimatedMemoryBytes(0) {
-  }
+      : root(nullptr), dimensions(0), treeSize(0), layout(KDLayout::Pointer),
+        splitPolicy(KDSplitPolicy::Cycle), seed(0), buildThreads(1),
+        leafSize(KD_DEFAULT_LEAF_SIZE), leafLevels(0), tightBounds(false),
+        buildTimeUs(0), totalInsertionTimeUs(0), estimatedMemoryBytes(0) {}
 
-  void build(vector<Point> &points) {
-    if (points.empty())
+  // El árbol copia las coordenadas que necesita (solo las data.dims()
+  // columnas de la vista); data puede liberarse después del build
+  void build(const DatasetView &data, KDLayout mode = KDLayout::Pointer,
+             int bucketSize = KD_DEFAULT_LEAF_SIZE) {
+    if (data.empty())
       return;
 
+    if (D != DYNAMIC_DIMS && data.dims() < D) {
+      cerr << "Error: los puntos tienen " << data.dims()
+           << " dimensiones, el árbol espera " << D << endl;
+      return;
+    }
+
     auto start = high_resolution_clock::now();
 
-    dimensions = points[0].size();
-    treeSize = points.size();
+    dimensions = D == DYNAMIC_DIMS ? data.dims() : D;
+    treeSize = data.size();
+    layout = mode;
+
+    vector<size_t> rows(treeSize);
+    iota(rows.begin(), rows.end(), size_t{0});
+
+    if (layout == KDLayout::Implicit) {
+      arena.clear();
+      coordArena.clear();
+      root = nullptr;
+      leafSize = clamp(bucketSize, 1, KD_MAX_LEAF_SIZE);
+      leafLevels = 0;
+      while ((treeSize + (size_t{1} << leafLevels) - 1) >> leafLevels >
+             size_t(leafSize))
+        ++leafLevels;
+
+      splitStorage.assign(firstLeaf(), 0.0);
+      axisStorage.assign(firstLeaf(), 0);
+      coordsStorage.assign(treeSize * dims(), 0.0);
+      idsStorage.assign(treeSize, -1);
+      boxStorage.clear();
+      if (tightBounds)
+        resetBoxes(2 * firstLeaf() + 1);
+      nodeBase = nullptr;
+      buildImplicit(data, rows, 0, 0, buildThreads);
+    } else {
+      splitStorage.clear();
+      axisStorage.clear();
+      coordsStorage.clear();
+      idsStorage.clear();
+      arena.clear();
+      coordArena.clear();
+      auto slots = arena.take(treeSize);
+      if constexpr (D == DYNAMIC_DIMS)
+        coordBase = coordArena.take(treeSize * dims()).next;
+      boxStorage.clear();
+      if (tightBounds)
+        resetBoxes(treeSize);
+      nodeBase = slots.next;
+      root = buildTree(data, rows, 0, 0, treeSize, buildThreads, slots);
+    }
 
-    root = buildTree(points, 0, 0, points.size());
+    snapshot = MappedFile();
+    flatSplit = splitStorage;
+    flatAxis = axisStorage;
+    flatCoords = coordsStorage;
+    flatIds = idsStorage;
 
     auto end = high_resolution_clock::now();
     buildTimeUs = duration_cast<nanoseconds>(end - start).count();
 
-    estimatedMemoryBytes =
-        treeSize * (sizeof(KDNode) + dimensions * sizeof(double));
+    // Solo el layout implícito se puede guardar con saveSnapshot
+    dataFingerprint = layout == KDLayout::Implicit ? data.fingerprint() : 0;
+
+    if (layout == KDLayout::Implicit)
+      estimatedMemoryBytes =
+          treeSize * (dims() * sizeof(double) + sizeof(int)) +
+          firstLeaf() * (sizeof(double) + sizeof(int));
+    else
+      estimatedMemoryBytes =
+          treeSize * (sizeof(KDNode) +
+                      (D == DYNAMIC_DIMS ? dims() * sizeof(double) : 0));
+    estimatedMemoryBytes += boxStorage.size() * sizeof(double);
+  }
+
+  void build(const vector<Point> &points, KDLayout mode = KDLayout::Pointer,
+             int bucketSize = KD_DEFAULT_LEAF_SIZE) {
+    build(Dataset::fromPoints(points, false), mode, bucketSize);
   }
 
-  void insertPoint(const Point &point) {
+  // Guarda el layout implícito ya construido para recargarlo con
+  // loadSnapshot sin reconstruir; false (y mensaje por cerr) si falla
+  bool saveSnapshot(const string &path) const {
+    if (layout != KDLayout::Implicit || treeSize == 0) {
+      cerr << "Error: solo se puede guardar un árbol implícito construido"
+           << endl;
+      return false;
+    }
+
+    auto alignUp = [](size_t bytes) {
+      return (bytes + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT *
+             DATASET_ALIGNMENT;
+    };
+
+    KDSnapshotHeader h{};
+    memcpy(h.magic, KD_SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = KD_SNAPSHOT_VERSION;
+    h.dims = dims();
+    h.size = treeSize;
+    h.leafSize = leafSize;
+    h.leafLevels = leafLevels;
+    h.fingerprint = dataFingerprint;
+    h.splitOffset = alignUp(sizeof(h));
+    h.axisOffset = alignUp(h.splitOffset + flatSplit.size_bytes());
+    h.coordsOffset = alignUp(h.axisOffset + flatAxis.size_bytes());
+    h.idsOffset = alignUp(h.coordsOffset + flatCoords.size_bytes());
+
+    h.checksum = checksum(flatSplit.data(), flatSplit.size_bytes());
+    h.checksum = checksum(flatAxis.data(), flatAxis.size_bytes(), h.checksum);
+    h.checksum =
+        checksum(flatCoords.data(), flatCoords.size_bytes(), h.checksum);
+    h.checksum = checksum(flatIds.data(), flatIds.size_bytes(), h.checksum);
+
+    ofstream out(path, ios::binary);
+    if (!out.is_open()) {
+      cerr << "Error: No se pudo crear el archivo " << path << endl;
+      return false;
+    }
+
+    size_t written = 0;
+    auto put = [&](size_t offset, const void *bytes, size_t count) {
+      static const char zeros[DATASET_ALIGNMENT] = {};
+      out.write(zeros, offset - written);
+      out.write(static_cast<const char *>(bytes), count);
+      written = offset + count;
+    };
+    put(0, &h, sizeof(h));
+    put(h.splitOffset, flatSplit.data(), flatSplit.size_bytes());
+    put(h.axisOffset, flatAxis.data(), flatAxis.size_bytes());
+    put(h.coordsOffset, flatCoords.data(), flatCoords.size_bytes());
+    put(h.idsOffset, flatIds.data(), flatIds.size_bytes());
+
+    if (!out) {
+      cerr << "Error: No se pudo escribir " << path << endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Proyecta un snapshot de saveSnapshot: las búsquedas leen el archivo
+  // directamente, sin reconstruir ni reservar nodos. Devuelve false (y el
+  // árbol queda como estaba) si el archivo no existe, es de otra versión o
+  // dimensión, no coincide su checksum o data no es el dataset con que se
+  // construyó. verify = false omite el checksum para no tocar todas las
+  // páginas al arrancar.
+  bool loadSnapshot(const string &path, const DatasetView &data,
+                    bool verify = true) {
+    if (!filesystem::exists(path))
+      return false;
+
+    MappedFile file(path);
+    KDSnapshotHeader h;
+    if (!file.valid() || file.size() < sizeof(h)) {
+      cerr << "Error: " << path << " no es un snapshot de KDTree" << endl;
+      return false;
+    }
+    memcpy(&h, file.data(), sizeof(h));
+
+    if (memcmp(h.magic, KD_SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != KD_SNAPSHOT_VERSION) {
+      cerr << "Error: " << path << " no es un snapshot de KDTree v"
+           << KD_SNAPSHOT_VERSION << endl;
+      return false;
+    }
+    if (D != DYNAMIC_DIMS && h.dims != D) {
+      cerr << "Error: el snapshot tiene " << h.dims
+           << " dimensiones, el árbol espera " << D << endl;
+      return false;
+    }
+
+    size_t internal = (size_t{1} << h.leafLevels) - 1;
+    uint64_t cells, splitEnd, axisEnd, coordsEnd, idsEnd;
+    if (h.dims == 0 || h.leafLevels >= 63 || h.splitOffset < sizeof(h) ||
+        !sectionEnd(h.splitOffset, internal, sizeof(double), splitEnd) ||
+        splitEnd > h.axisOffset ||
+        !sectionEnd(h.axisOffset, internal, sizeof(int), axisEnd) ||
+        axisEnd > h.coordsOffset ||
+        __builtin_mul_overflow(h.size, uint64_t(h.dims), &cells) ||
+        !sectionEnd(h.coordsOffset, cells, sizeof(double), coordsEnd) ||
+        coordsEnd > h.idsOffset ||
+        !sectionEnd(h.idsOffset, h.size, sizeof(int), idsEnd) ||
+        idsEnd > file.size() || h.coordsOffset % alignof(double) != 0) {
+      cerr << "Error: " << path << " está truncado o corrupto" << endl;
+      return false;
+    }
+
+    if (h.fingerprint != data.fingerprint()) {
+      cerr << "Aviso: " << path << " corresponde a otro dataset" << endl;
+      return false;
+    }
+
+    auto section = [&](uint64_t offset) { return file.data() + offset; };
+    span<const double> split(
+        reinterpret_cast<const double *>(section(h.splitOffset)), internal);
+    span<const int> axis(reinterpret_cast<const int *>(section(h.axisOffset)),
+                         internal);
+    span<const double> coords(
+        reinterpret_cast<const double *>(section(h.coordsOffset)),
+        h.size * h.dims);
+    span<const int> ids(reinterpret_cast<const int *>(section(h.idsOffset)),
+                        h.size);
+
+    if (verify) {
+      uint64_t sum = checksum(split.data(), split.size_bytes());
+      sum = checksum(axis.data(), axis.size_bytes(), sum);
+      sum = checksum(coords.data(), coords.size_bytes(), sum);
+      sum = checksum(ids.data(), ids.size_bytes(), sum);
+      if (sum != h.checksum) {
+        cerr << "Error: checksum incorrecto en " << path << endl;
+        return false;
+      }
+    }
+
+    arena.clear();
+    coordArena.clear();
+    root = nullptr;
+    boxStorage = {};
+    nodeBase = nullptr;
+    splitStorage = {};
+    axisStorage = {};
+    coordsStorage = {};
+    idsStorage = {};
+    snapshot = move(file);
+    flatSplit = split;
+    flatAxis = axis;
+    flatCoords = coords;
+    flatIds = ids;
+
+    layout = KDLayout::Implicit;
+    dimensions = h.dims;
+    treeSize = h.size;
+    leafSize = h.leafSize;
+    leafLevels = h.leafLevels;
+    dataFingerprint = h.fingerprint;
+    buildTimeUs = 0;
+    estimatedMemoryBytes = split.size_bytes() + axis.size_bytes() +
+                           coords.size_bytes() + ids.size_bytes();
+    return true;
+  }
+
+  // Hilos para build(); 0 usa todos los núcleos disponibles. El árbol
+  // resultante es el mismo con cualquier número de hilos
+  void setBuildThreads(unsigned threads) {
+    buildThreads = resolveThreads(threads);
+  }
+  unsigned getBuildThreads() const { return buildThreads; }
+
+  // Cajas ajustadas por nodo para el siguiente build(): podan además por la
+  // distancia a la caja de los puntos del subárbol, más estrecha que la
+  // celda. Cuestan 2 * dims doubles por nodo y no se guardan en el snapshot.
+  void setTightBounds(bool enabled) { tightBounds = enabled; }
+  bool getTightBounds() const { return tightBounds; }
+
+  // Política de corte del siguiente build(); el eje elegido queda en cada
+  // nodo, así las búsquedas y los snapshots no dependen de ella
+  void setSplitPolicy(KDSplitPolicy policy) { splitPolicy = policy; }
+  KDSplitPolicy getSplitPolicy() const { return splitPolicy; }
+
+  // Semilla de RandomTopVariance
+  void setSeed(uint64_t value) { seed = value; }
+  uint64_t getSeed() const { return seed; }
+
+  void insertPoint(const PointView &point) {
+    if (layout == KDLayout::Implicit) {
+      cerr << "Error: el layout implícito no admite inserciones" << endl;
+      return;
+    }
+
     auto start = high_resolution_clock::now();
 
     if (dimensions == 0) {
-      dimensions = point.size();
+      dimensions = D == DYNAMIC_DIMS ? point.size() : D;
     }
 
+    // Las cajas de build no cubren los puntos insertados
+    boxStorage.clear();
     insert(root, point, 0);
 
     auto end = high_resolution_clock::now();
@@ -174,44 +1160,162 @@ public:
     totalInsertionTimeUs += insertionTime;
   }
 
-  Point nearestNeighbor(const Point &target, double &searchTime) {
+  // Las consultas son const y no modifican el árbol: varios hilos pueden
+  // buscar a la vez. Las métricas se suman a stats si se pasa.
+  Point nearestNeighbor(const PointView &target, double &searchTime,
+                        SearchStats *stats = nullptr) const {
     auto start = high_resolution_clock::now();
 
-    const KDNode *best = nullptr;
-    double bestDist = numeric_limits<double>::max();
+    SearchStats local;
+    Point result;
+    double bestDistSq = numeric_limits<double>::max();
+    auto off = cellOffsets();
 
-    nearestNeighbor(root.get(), target, best, bestDist);
+    if (layout == KDLayout::Implicit) {
+      size_t best = flatIds.size();
+      nearestNeighbor(size_t{0}, target.data(), best, bestDistSq, off.data(),
+                      0.0, local);
+      if (best < flatIds.size())
+        result = flatToPoint(best);
+    } else {
+      const KDNode *best = nullptr;
+      nearestNeighbor(root, target.data(), best, bestDistSq, off.data(), 0.0,
+                      local);
+      if (best)
+        result = best->toPoint();
+    }
 
     auto end = high_resolution_clock::now();
     searchTime = duration_cast<nanoseconds>(end - start).count();
-    totalSearchTimeUs += searchTime;
+    if (stats) {
+      local.queries = 1;
+      local.searchTimeNs = searchTime;
+      *stats += local;
+    }
 
-    return best ? best->point : Point();
+    return result;
   }
 
-  vector<Point> kNearestNeighbors(const Point &target, int k,
-                                  double &searchTime) {
+  vector<Point> kNearestNeighbors(const PointView &target, int k,
+                                  double &searchTime,
+                                  SearchStats *stats = nullptr) const {
     auto start = high_resolution_clock::now();
 
-    priority_queue<pair<double, const Point *>> heap;
+    SearchStats local;
+    vector<Point> result;
+    auto off = cellOffsets();
+
+    if (layout == KDLayout::Implicit) {
+      priority_queue<pair<double, size_t>> heap;
+      kNearestNeighbors(size_t{0}, target.data(), k, heap, off.data(), 0.0,
+                        local);
+      while (!heap.empty()) {
+        result.push_back(flatToPoint(heap.top().second));
+        heap.pop();
+      }
+    } else {
+      priority_queue<pair<double, const KDNode *>> heap;
+      kNearestNeighbors(root, target.data(), k, heap, off.data(), 0.0, local);
+      while (!heap.empty()) {
+        result.push_back(heap.top().second->toPoint());
+        heap.pop();
+      }
+    }
+    reverse(result.begin(), result.end());
+
+    auto end = high_resolution_clock::now();
+    searchTime = duration_cast<nanoseconds>(end - start).count();
+    if (stats) {
+      local.queries = 1;
+      local.searchTimeNs = searchTime;
+      *stats += local;
+    }
+
+    return result;
+  }
 
-    kNearestNeighbors(root.get(), target, k, heap);
+  // kNN aproximado (best-bin-first) con epsilon >= 0: cada vecino devuelto
+  // está a lo sumo (1 + epsilon) veces más lejos que el verdadero vecino de
+  // su posición. maxChecks limita las distancias evaluadas (0 = sin
+  // límite; el layout implícito termina la hoja empezada) y checks devuelve
+  // las que se gastaron. Con el límite puede devolver menos de k puntos.
+  // epsilon = 0 sin límite da el mismo resultado que kNearestNeighbors.
+  vector<Point> approxKNearestNeighbors(const PointView &target, int k,
+                                        double epsilon, size_t maxChecks,
+                                        size_t &checks, double &searchTime,
+                                        SearchStats *stats = nullptr) const {
+    auto start = high_resolution_clock::now();
 
+    SearchStats local;
     vector<Point> result;
-    while (!heap.empty()) {
-      result.push_back(*heap.top().second);
-      heap.pop();
+    double scale = (1.0 + max(epsilon, 0.0)) * (1.0 + max(epsilon, 0.0));
+
+    if (k > 0 && layout == KDLayout::Implicit && treeSize > 0) {
+      priority_queue<pair<double, size_t>> heap;
+      approxKNearestNeighbors(size_t{0}, target.data(), k, scale, maxChecks,
+                              heap, local);
+      while (!heap.empty()) {
+        result.push_back(flatToPoint(heap.top().second));
+        heap.pop();
+      }
+    } else if (k > 0) {
+      priority_queue<pair<double, const KDNode *>> heap;
+      approxKNearestNeighbors(root, target.data(), k, scale, maxChecks, heap,
+                              local);
+      while (!heap.empty()) {
+        result.push_back(heap.top().second->toPoint());
+        heap.pop();
+      }
     }
     reverse(result.begin(), result.end());
 
     auto end = high_resolution_clock::now();
     searchTime = duration_cast<nanoseconds>(end - start).count();
-    totalSearchTimeUs += searchTime;
+    checks = local.distanceCalls;
+    if (stats) {
+      local.queries = 1;
+      local.searchTimeNs = searchTime;
+      *stats += local;
+    }
 
     return result;
   }
 
-  int getDepth() const { return calculateDepth(root.get()); }
+  // kNN para nq consultas (matriz fila por fila con getDimensions()
+  // columnas) repartidas entre hilos; 0 usa todos los núcleos. Resultados en
+  // outIds/outDists[q * k + i]. Cada hilo acumula sus propias métricas y
+  // se suman a stats al terminar.
+  void knnBatch(const double *queries, size_t nq, int k, int *outIds,
+                double *outDists, unsigned threads = 0,
+                SearchStats *stats = nullptr) const {
+    if (k <= 0)
+      return;
+
+    threads = resolveThreads(threads);
+    vector<SearchStats> workerStats(threads);
+
+    parallelFor(nq, KD_BATCH_GRAIN, threads,
+                [&](size_t begin, size_t end, size_t worker) {
+                  auto start = high_resolution_clock::now();
+                  for (size_t q = begin; q < end; ++q)
+                    knnInto(queries + q * dims(), k, outIds + q * k,
+                            outDists + q * k, workerStats[worker]);
+                  auto stop = high_resolution_clock::now();
+                  workerStats[worker].queries += end - begin;
+                  workerStats[worker].searchTimeNs +=
+                      duration_cast<nanoseconds>(stop - start).count();
+                });
+
+    if (stats)
+      for (auto &s : workerStats)
+        *stats += s;
+  }
+
+  int getDepth() const {
+    if (layout == KDLayout::Implicit)
+      return leafLevels + 1;
+    return calculateDepth(root);
+  }
   double getBalanceFactor() const {
     int depth = getDepth();
     if (depth == 0 || treeSize == 0)
@@ -228,4 +1332,6 @@ public:
 
   int size() const { return treeSize; }
   int getDimensions() const { return dimensions; }
+  KDLayout getLayout() const { return layout; }
+  int getLeafSize() const { return leafSize; }
 };
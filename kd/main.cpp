@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "funcs.hpp"
+#include "kd_forest.hpp"
 #include "kd_tree.hpp"
 
 using namespace std;
@@ -36,7 +37,7 @@ void generateStatisticalSummary(const vector<vector<string>> &allResults) {
     if (tipo == "balanceado") {
       nnBalancedByDim[dims].push_back(avgNN);
       knnBalancedByDim[dims].push_back(avgKNN);
-    } else {
+    } else if (tipo == "desbalanceado") {
       nnUnbalancedByDim[dims].push_back(avgNN);
       knnUnbalancedByDim[dims].push_back(avgKNN);
     }
@@ -86,6 +87,116 @@ void generateStatisticalSummary(const vector<vector<string>> &allResults) {
   cout << "Resumen estadístico guardado en resumen_estadistico_kdtree.txt\n";
 }
 
+// Construye un árbol estático (sin inserciones) y mide NN/kNN sobre las
+// consultas; D permite comparar la versión especializada con la dinámica
+template <size_t D>
+vector<string> runStaticTree(const DatasetView &dataset,
+                             const vector<PointView> &queryPoints, int k,
+                             KDLayout layout, const string &tipo,
+                             bool tightBounds = false,
+                             KDSplitPolicy policy = KDSplitPolicy::Cycle) {
+  KDTree<D> tree;
+  tree.setTightBounds(tightBounds);
+  tree.setSplitPolicy(policy);
+  auto startBuild = high_resolution_clock::now();
+  tree.build(dataset, layout);
+  auto endBuild = high_resolution_clock::now();
+  double buildTime =
+      duration_cast<nanoseconds>(endBuild - startBuild).count();
+
+  double totalNNTime = 0, totalKNNTime = 0;
+  for (const auto &query : queryPoints) {
+    double searchTime;
+    tree.nearestNeighbor(query, searchTime);
+    totalNNTime += searchTime;
+
+    tree.kNearestNeighbors(query, k, searchTime);
+    totalKNNTime += searchTime;
+  }
+
+  return {to_string(tree.getDimensions()),
+          to_string(dataset.size()),
+          to_string(queryPoints.size()),
+          to_string(k),
+          tipo,
+          to_string(buildTime),
+          "0",
+          to_string(totalNNTime),
+          to_string(totalNNTime / queryPoints.size()),
+          to_string(totalKNNTime),
+          to_string(totalKNNTime / queryPoints.size()),
+          to_string(tree.getDepth()),
+          to_string(tree.getBalanceFactor()),
+          to_string(tree.estimatedMemoryBytes / 1024.0)};
+}
+
+// Recall@k y latencia de las búsquedas aproximadas (KDTree con límite de
+// distancias y KDForest) frente a los vecinos exactos por fuerza bruta;
+// filas de recall_latencia_kdtree.csv
+vector<vector<string>>
+runRecallExperiments(const DatasetView &dataset,
+                     const vector<PointView> &queryPoints, int k,
+                     const vector<size_t> &checkBudgets,
+                     const vector<int> &forestSizes) {
+  vector<vector<double>> exact;
+  for (const auto &query : queryPoints)
+    exact.push_back(bruteForceKnn(dataset, query.data(), k));
+
+  vector<vector<string>> rows;
+  auto measure = [&](const string &indice, int trees, size_t maxChecks,
+                     auto &&search) {
+    double totalTime = 0, totalRecall = 0;
+    size_t totalChecks = 0;
+    for (size_t q = 0; q < queryPoints.size(); ++q) {
+      double searchTime;
+      size_t checks;
+      vector<int> found;
+      for (const auto &p : search(queryPoints[q], checks, searchTime))
+        found.push_back(p.id);
+      totalTime += searchTime;
+      totalChecks += checks;
+      totalRecall +=
+          recallAtK(dataset, queryPoints[q].data(), found, exact[q]);
+    }
+
+    double n = queryPoints.size();
+    rows.push_back({to_string(dataset.dims()), to_string(dataset.size()),
+                    to_string(k), indice, to_string(trees), "0",
+                    to_string(maxChecks), to_string(totalRecall / n),
+                    to_string(totalTime / n), to_string(totalChecks / n)});
+  };
+
+  KDTree tree;
+  tree.build(dataset, KDLayout::Implicit);
+  measure("kd_exacto", 1, 0, [&](const PointView &query, size_t &checks,
+                                 double &searchTime) {
+    SearchStats stats;
+    auto result = tree.kNearestNeighbors(query, k, searchTime, &stats);
+    checks = stats.distanceCalls;
+    return result;
+  });
+
+  for (size_t maxChecks : checkBudgets)
+    measure("kd_aproximado", 1, maxChecks,
+            [&](const PointView &query, size_t &checks, double &searchTime) {
+              return tree.approxKNearestNeighbors(query, k, 0.0, maxChecks,
+                                                  checks, searchTime);
+            });
+
+  for (int trees : forestSizes) {
+    KDForest forest(trees);
+    forest.build(dataset);
+    for (size_t maxChecks : checkBudgets)
+      measure("kd_bosque", trees, maxChecks,
+              [&](const PointView &query, size_t &checks, double &searchTime) {
+                return forest.kNearestNeighbors(query, k, maxChecks, checks,
+                                                searchTime);
+              });
+  }
+
+  return rows;
+}
+
 int main() {
   string inputFile = "dataset/images_dataset.csv";
 
@@ -98,7 +209,7 @@ int main() {
 
   // Leer dataset base
   cout << "\nCargando dataset base..." << endl;
-  vector<Point> baseData = readCSV(inputFile, 20000, -1); // Máximo 20k puntos
+  Dataset baseData = loadDataset(inputFile, 20000); // Máximo 20k puntos
 
   if (baseData.empty()) {
     cerr << "Error: No se pudieron cargar datos del archivo" << endl;
@@ -106,7 +217,7 @@ int main() {
   }
 
   cout << "Dataset base cargado: " << baseData.size() << " puntos con "
-       << baseData[0].size() << " dimensiones\n";
+       << baseData.dims() << " dimensiones\n";
 
   // Cabeceras para el CSV de resultados
   vector<string> headers = {"dimensiones",
@@ -129,20 +240,15 @@ int main() {
   int totalExperiments = 0;
 
   for (int dims : dimensionsToTest) {
-    if (dims > (int)baseData[0].size())
+    if (dims > (int)baseData.dims())
       continue;
 
     for (int dataSize : dataSizes) {
       if (dataSize > (int)baseData.size())
         continue;
 
-      // Crear subconjunto con dimensiones reducidas
-      vector<Point> dataset;
-      for (int i = 0; i < dataSize; i++) {
-        vector<double> coords(baseData[i].coords.begin(),
-                              baseData[i].coords.begin() + dims);
-        dataset.push_back(Point(coords, baseData[i].id));
-      }
+      // Vista de las primeras dataSize filas y dims columnas (sin copia)
+      DatasetView dataset = baseData.view(dataSize, dims);
 
       cout << "\n[Experimento] Dims: " << dims << ", Datos: " << dataSize
            << endl;
@@ -151,7 +257,7 @@ int main() {
         if (searchCount > dataSize / 2)
           continue;
 
-        vector<Point> queryPoints;
+        vector<PointView> queryPoints;
         int startIdx = dataSize / 2;
         int endIdx = min(startIdx + searchCount, dataSize);
 
@@ -194,13 +300,47 @@ int main() {
                to_string(balancedTree.getBalanceFactor()),
                to_string(balancedTree.estimatedMemoryBytes / 1024.0)});
 
+          // ===== ÁRBOL IMPLÍCITO (arreglo por niveles) =====
+          allResults.push_back(runStaticTree<DYNAMIC_DIMS>(
+              dataset, queryPoints, k, KDLayout::Implicit, "implicito"));
+
+          // ===== CAJAS AJUSTADAS POR NODO =====
+          allResults.push_back(runStaticTree<DYNAMIC_DIMS>(
+              dataset, queryPoints, k, KDLayout::Pointer, "balanceado_cajas",
+              true));
+          allResults.push_back(runStaticTree<DYNAMIC_DIMS>(
+              dataset, queryPoints, k, KDLayout::Implicit, "implicito_cajas",
+              true));
+
+          // ===== POLÍTICAS DE CORTE =====
+          for (auto [policy, tipo] :
+               {pair{KDSplitPolicy::MaxSpread, "balanceado_rango"},
+                pair{KDSplitPolicy::MaxVariance, "balanceado_varianza"},
+                pair{KDSplitPolicy::SlidingMidpoint,
+                     "balanceado_deslizante"}})
+            allResults.push_back(runStaticTree<DYNAMIC_DIMS>(
+                dataset, queryPoints, k, KDLayout::Pointer, tipo, false,
+                policy));
+
+          // ===== DIMENSIÓN FIJA EN COMPILACIÓN =====
+          dispatchDims(dims, [&](auto fixedDims) {
+            constexpr size_t D = decltype(fixedDims)::value;
+            if constexpr (D != DYNAMIC_DIMS) {
+              allResults.push_back(runStaticTree<D>(
+                  dataset, queryPoints, k, KDLayout::Pointer,
+                  "balanceado_fijo"));
+              allResults.push_back(runStaticTree<D>(
+                  dataset, queryPoints, k, KDLayout::Implicit,
+                  "implicito_fijo"));
+            }
+          });
+
           // ===== ÁRBOL DESBALANCEADO =====
           if (dataSize >= 10) {
             KDTree unbalancedTree;
 
             // Construir con primer punto
-            vector<Point> firstPoint = {dataset[0]};
-            unbalancedTree.build(firstPoint);
+            unbalancedTree.build(baseData.view(1, dims));
 
             // Insertar puntos restantes
             double totalInsertTime = 0;
@@ -240,6 +380,34 @@ int main() {
     }
   }
 
+  // ===== RECALL VS LATENCIA (búsquedas aproximadas) =====
+  const int recallK = 10;
+  const vector<size_t> checkBudgets = {50, 100, 200, 500, 1000, 2000};
+  const vector<int> forestSizes = {1, 2, 4, 8};
+  vector<vector<string>> recallResults;
+
+  for (int dims : dimensionsToTest) {
+    if (dims > (int)baseData.dims())
+      continue;
+
+    int dataSize = min<int>(dataSizes.back(), baseData.size());
+    DatasetView dataset = baseData.view(dataSize, dims);
+
+    vector<PointView> queryPoints;
+    int startIdx = dataSize / 2;
+    int endIdx = min(startIdx + searchCounts.back(), dataSize);
+    for (int i = startIdx; i < endIdx; i++)
+      queryPoints.push_back(dataset[i]);
+
+    cout << "\n[Recall] Dims: " << dims << ", Datos: " << dataSize << endl;
+    for (auto &row : runRecallExperiments(dataset, queryPoints, recallK,
+                                          checkBudgets, forestSizes))
+      recallResults.push_back(move(row));
+  }
+
+  string recallFile = "recall_latencia_kdtree.csv";
+  saveMetricsToCSV(recallFile, recallResults, RECALL_CSV_HEADERS);
+
   string resultsFile = "resultados_experimentos_kdtree.csv";
 
   saveMetricsToCSV(resultsFile, allResults, headers);
@@ -282,7 +450,21 @@ int main() {
     if (i < kValues.size() - 1)
       config << ", ";
   }
-  config << "\n\n";
+  config << "\n";
+  config << "Tamaño de hoja (implícito): " << KD_DEFAULT_LEAF_SIZE << "\n";
+  config << "Poda: distancia incremental a la celda; variantes *_cajas con "
+            "cajas ajustadas por nodo\n";
+  config << "Ejes de corte: alternos; variantes _rango (mayor rango), "
+            "_varianza (mayor varianza en " << KD_VARIANCE_SAMPLE
+         << " filas) y _deslizante (punto medio deslizante)\n";
+  config << "Recall vs latencia (k = " << recallK
+         << "): KD exacto, KD aproximado y KDForest de";
+  for (int trees : forestSizes)
+    config << " " << trees;
+  config << " árboles con límite de";
+  for (size_t maxChecks : checkBudgets)
+    config << " " << maxChecks;
+  config << " distancias\n\n";
 
   config << "Total experimentos: " << totalExperiments << "\n";
   config << "Resultados guardados en: " << resultsFile << "\n";
@@ -292,6 +474,7 @@ int main() {
   cout << "Total experimentos realizados: " << totalExperiments << endl;
   cout << "Resultados principales: " << resultsFile << endl;
   cout << "Resumen estadístico: resumen_estadistico_kdtree.txt" << endl;
+  cout << "Recall vs latencia: " << recallFile << endl;
   cout << "Configuración: configuracion_experimentos.txt" << endl;
 
   return 0;
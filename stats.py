@@ -11,6 +11,7 @@ os.makedirs(PLOT_DIR, exist_ok=True)
 
 kd_df = pd.read_csv("resultados_experimentos_kdtree.csv")
 vp_df = pd.read_csv("resultados_experimentos_vptree.csv")
+vp_df = vp_df[vp_df["variante"] == "dinamico"]
 
 kd_df["arbol"] = "KD-Tree"
 vp_df["arbol"] = "VP-Tree"
@@ -42,7 +43,13 @@ def plot_kd_vs_vp(kd, vp, x, y, title, ylabel, filename):
     plt.close()
 
 
-for tipo in ["balanceado", "desbalanceado"]:
+for tipo in [
+    "balanceado",
+    "desbalanceado",
+    "implicito",
+    "balanceado_fijo",
+    "implicito_fijo",
+]:
     kd_dim = data_dim[
         (data_dim["arbol"] == "KD-Tree") & (data_dim["tipo_arbol"] == tipo)
     ]
@@ -117,3 +124,41 @@ for tipo in ["balanceado", "desbalanceado"]:
         ylabel="Tiempo (ns)",
         filename=f"construccion_size_kd_{tipo}_vs_vp.png",
     )
+
+
+# -------------------------
+# Recall vs latencia (búsquedas aproximadas)
+# -------------------------
+recall_files = ["recall_latencia_kdtree.csv", "recall_latencia_vptree.csv"]
+recall_dfs = [pd.read_csv(f) for f in recall_files if os.path.exists(f)]
+
+if recall_dfs:
+    recall_df = pd.concat(recall_dfs, ignore_index=True)
+    recall_df["serie"] = recall_df.apply(
+        lambda row: f"{row['indice']} x{row['arboles']}"
+        if row["indice"] == "kd_bosque"
+        else row["indice"],
+        axis=1,
+    )
+    recall_df = recall_df.sort_values(["serie", "max_checks", "epsilon"])
+
+    for dims, df in recall_df.groupby("dimensiones"):
+        plt.figure()
+        sns.lineplot(
+            data=df,
+            x="tiempo_busqueda_promedio_ns",
+            y="recall",
+            hue="serie",
+            marker="o",
+            sort=False,
+        )
+
+        plt.title(f"Recall vs latencia kNN ({dims} dimensiones)")
+        plt.xlabel("Tiempo por consulta (ns)")
+        plt.ylabel("Recall@k")
+        plt.xscale("log")
+        plt.tight_layout()
+
+        path = os.path.join(PLOT_DIR, f"recall_latencia_dim_{dims}.png")
+        plt.savefig(path, dpi=300, bbox_inches="tight")
+        plt.close()
@@ -0,0 +1,47 @@
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "funcs.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// Convierte un CSV id,f1,f2,... al formato binario de Dataset (ver
+// dataset.hpp). Por defecto escribe junto al CSV con extensión .bin, que es
+// donde lo busca loadDataset.
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    cerr << "Uso: " << argv[0] << " <entrada.csv> [salida.bin]" << endl;
+    return 1;
+  }
+
+  string input = argv[1];
+  string output = argc > 2
+                      ? string(argv[2])
+                      : filesystem::path(input).replace_extension(".bin").string();
+
+  auto start = high_resolution_clock::now();
+
+  CsvReport report;
+  Dataset data = readDataset(input, -1, -1, 0, &report);
+  if (data.empty()) {
+    cerr << "Error: No se pudieron cargar datos de " << input << endl;
+    return 1;
+  }
+
+  if (!data.saveBinary(output))
+    return 1;
+
+  auto end = high_resolution_clock::now();
+
+  cout << "Convertido " << input << " -> " << output << ": " << data.size()
+       << " filas, " << data.dims() << " dimensiones";
+  if (report.malformed > 0)
+    cout << ", " << report.malformed << " filas descartadas";
+  cout << " (" << duration_cast<milliseconds>(end - start).count() << " ms)"
+       << endl;
+
+  return 0;
+}
@@ -10,6 +10,9 @@
 using namespace std;
 using namespace std::chrono;
 
+// Semilla fija: corridas reproducibles del benchmark
+constexpr uint64_t VP_SEED = 42;
+
 void generateVPStatisticalSummary(const vector<vector<string>> &results,
                                   const vector<double> &allPruningRates,
                                   const vector<double> &allBuildTimes,
@@ -53,7 +56,7 @@ void generateVPStatisticalSummary(const vector<vector<string>> &results,
   map<int, vector<double>> radiusByDim;
 
   for (const auto &row : results) {
-    if (row.size() < 15)
+    if (row.size() < 16 || row[15] != "dinamico")
       continue;
 
     int dims = stoi(row[0]);            // dimensiones
@@ -91,7 +94,7 @@ void generateVPStatisticalSummary(const vector<vector<string>> &results,
   map<int, vector<double>> depthBySize;
 
   for (const auto &row : results) {
-    if (row.size() < 15)
+    if (row.size() < 16 || row[15] != "dinamico")
       continue;
 
     int size = stoi(row[1]);            // datos_entrenamiento
@@ -159,6 +162,150 @@ void generateVPStatisticalSummary(const vector<vector<string>> &results,
   summary.close();
 }
 
+template <size_t D>
+vector<string> runVPExperiment(const DatasetView &dataset,
+                               const vector<PointView> &queryPoints, int k,
+                               const string &variante, double &buildTime,
+                               double &avgPruningRate,
+                               VPLayout layout = VPLayout::Pointer,
+                               VPSearchOrder order = VPSearchOrder::DepthFirst) {
+  int dims = dataset.dims();
+  int dataSize = dataset.size();
+
+  VP_tree<D> vpTree(dataset);
+  vpTree.set_seed(VP_SEED);
+  vpTree.set_search_order(order);
+
+  auto startBuild = high_resolution_clock::now();
+  vpTree.build(true, layout);
+  auto endBuild = high_resolution_clock::now();
+  buildTime = duration_cast<nanoseconds>(endBuild - startBuild).count();
+
+  SearchStats totalStats;
+
+  double totalNNTime = 0, totalKNNTime = 0;
+  double totalPruningRate = 0;
+  double totalVisitedNodes = 0;
+
+  for (const auto &query : queryPoints) {
+    double searchTime;
+
+    // NN
+    SearchStats nnStats;
+
+    auto start = high_resolution_clock::now();
+    vpTree.nn(query.id, &nnStats);
+    auto end = high_resolution_clock::now();
+    searchTime = duration_cast<nanoseconds>(end - start).count();
+
+    totalNNTime += searchTime;
+
+    // k-NN
+    SearchStats knnStats;
+
+    start = high_resolution_clock::now();
+    vpTree.knn(query.id, k, &knnStats);
+    end = high_resolution_clock::now();
+    searchTime = duration_cast<nanoseconds>(end - start).count();
+
+    totalKNNTime += searchTime;
+
+    totalPruningRate += (vpTree.get_prunning_rate(nnStats) +
+                         vpTree.get_prunning_rate(knnStats)) /
+                        2.0;
+    totalVisitedNodes +=
+        (nnStats.visitedNodes + knnStats.visitedNodes) / 2.0;
+
+    totalStats += nnStats;
+    totalStats += knnStats;
+  }
+
+  double avgNN = totalNNTime / queryPoints.size();
+  double avgKNN = totalKNNTime / queryPoints.size();
+  avgPruningRate = totalPruningRate / queryPoints.size();
+  double avgVisitedNodes = totalVisitedNodes / queryPoints.size();
+
+  // Estadisticas globales
+  double avgPartitionRadius = vpTree.get_average_partition_radius();
+  long totalDistanceCalls = totalStats.distanceCalls;
+
+  cout << "  [VP-Tree " << variante << "] Dims: " << dims
+       << ", Tamaño: " << dataSize
+       << ", Poda: " << avgPruningRate
+       << ", Distancias: " << totalDistanceCalls
+       << ", Radio: " << avgPartitionRadius << endl;
+
+  return {to_string(dims),
+          to_string(dataSize),
+          to_string(queryPoints.size()),
+          to_string(k),
+          to_string(buildTime),
+          to_string(totalNNTime),
+          to_string(avgNN),
+          to_string(totalKNNTime),
+          to_string(avgKNN),
+          to_string(vpTree.get_depth()),
+          to_string(avgPruningRate),
+          to_string(totalDistanceCalls),
+          to_string(avgVisitedNodes),
+          to_string(avgPartitionRadius),
+          to_string(vpTree.estimatedMemoryBytes / 1024.0),
+          variante};
+}
+
+// Recall@k y latencia del VP-tree frente a los vecinos exactos por fuerza
+// bruta, mismas columnas que recall_latencia_kdtree.csv para comparar con
+// las búsquedas aproximadas del KD-tree
+vector<vector<string>>
+runVPRecallExperiments(const DatasetView &dataset,
+                       const vector<PointView> &queryPoints, int k,
+                       const vector<double> &epsilons,
+                       const vector<size_t> &budgets) {
+  vector<vector<double>> exact;
+  for (const auto &query : queryPoints)
+    exact.push_back(bruteForceKnn(dataset, query.data(), k));
+
+  VP_tree vpTree(dataset);
+  vpTree.set_seed(VP_SEED);
+  vpTree.build();
+
+  vector<vector<string>> rows;
+  auto measure = [&](const string &indice, VPSearchOrder order,
+                     double epsilon, size_t budget) {
+    vpTree.set_search_order(order);
+    vpTree.set_epsilon(epsilon);
+    vpTree.set_distance_budget(budget);
+
+    SearchStats stats;
+    double totalTime = 0, totalRecall = 0;
+    for (size_t q = 0; q < queryPoints.size(); ++q) {
+      auto start = high_resolution_clock::now();
+      auto found = vpTree.knn(queryPoints[q].id, k, &stats);
+      auto end = high_resolution_clock::now();
+      totalTime += duration_cast<nanoseconds>(end - start).count();
+      totalRecall +=
+          recallAtK(dataset, queryPoints[q].data(), found, exact[q]);
+    }
+
+    double n = queryPoints.size();
+    rows.push_back({to_string(dataset.dims()), to_string(dataset.size()),
+                    to_string(k), indice, "1", to_string(epsilon),
+                    to_string(budget), to_string(totalRecall / n),
+                    to_string(totalTime / n),
+                    to_string(stats.distanceCalls / n)});
+  };
+
+  measure("vp_exacto", VPSearchOrder::DepthFirst, 0, 0);
+  measure("vp_mejor_primero", VPSearchOrder::BestFirst, 0, 0);
+  for (double epsilon : epsilons)
+    measure("vp_aproximado", VPSearchOrder::DepthFirst, epsilon, 0);
+  // Con límite conviene bajar primero por los subárboles más prometedores
+  for (size_t budget : budgets)
+    measure("vp_presupuesto", VPSearchOrder::BestFirst, 0, budget);
+
+  return rows;
+}
+
 int main() {
   string inputFile = "dataset/images_dataset.csv";
 
@@ -171,7 +318,7 @@ int main() {
 
   // Leer dataset base
   cout << "\nCargando dataset base..." << endl;
-  vector<Point> baseData = readCSV(inputFile, 20000, -1); // Máximo 20k puntos
+  Dataset baseData = loadDataset(inputFile, 20000); // Máximo 20k puntos
 
   if (baseData.empty()) {
     cerr << "Error: No se pudieron cargar datos del archivo" << endl;
@@ -179,7 +326,7 @@ int main() {
   }
 
   cout << "Dataset base cargado: " << baseData.size() << " puntos con "
-       << baseData[0].size() << " dimensiones\n";
+       << baseData.dims() << " dimensiones\n";
 
   // Cabeceras para el CSV de resultados
   vector<string> headers = {"dimensiones",
@@ -196,7 +343,8 @@ int main() {
                             "llamadas_distancia_total",
                             "nodos_visitados_promedio",
                             "radio_promedio_particion",
-                            "memoria_estimada_kb"};
+                            "memoria_estimada_kb",
+                            "variante"};
 
   vector<vector<string>> allResults;
 
@@ -207,20 +355,15 @@ int main() {
   vector<double> allBuildTimes;
 
   for (int dims : dimensionsToTest) {
-    if (dims > (int)baseData[0].size())
+    if (dims > (int)baseData.dims())
       continue;
 
     for (int dataSize : dataSizes) {
       if (dataSize > (int)baseData.size())
         continue;
 
-      // Crear subconjunto con dimensiones reducidas
-      vector<Point> dataset;
-      for (int i = 0; i < dataSize; i++) {
-        vector<double> coords(baseData[i].coords.begin(),
-                              baseData[i].coords.begin() + dims);
-        dataset.push_back(Point(coords, baseData[i].id));
-      }
+      // Vista de las primeras dataSize filas y dims columnas (sin copia)
+      DatasetView dataset = baseData.view(dataSize, dims);
 
       cout << "\n[Experimento] Dims: " << dims << ", Datos: " << dataSize
            << endl;
@@ -229,7 +372,7 @@ int main() {
         if (searchCount > dataSize / 2)
           continue;
 
-        vector<Point> queryPoints;
+        vector<PointView> queryPoints;
         int startIdx = dataSize / 2;
         int endIdx = min(startIdx + searchCount, dataSize);
 
@@ -243,93 +386,75 @@ int main() {
 
           totalExperiments++;
 
-          VP_tree vpTree(dataset);
-
-          auto startBuild = high_resolution_clock::now();
-          vpTree.build();
-          auto endBuild = high_resolution_clock::now();
-          double buildTime =
-              duration_cast<nanoseconds>
-(endBuild - startBuild).count();
+          double buildTime, avgPruningRate;
+          allResults.push_back(runVPExperiment<DYNAMIC_DIMS>(
+              dataset, queryPoints, k, "dinamico", buildTime,
+              avgPruningRate));
 
           allBuildTimes.push_back(buildTime);
+          allPruningRates.push_back(avgPruningRate);
 
-          vpTree.reset_search_metrics();
-
-          double totalNNTime = 0, totalKNNTime = 0;
-          double totalPruningRate = 0;
-          double totalVisitedNodes = 0;
-
-          for (const auto &query : queryPoints) {
-            double searchTime;
-
-            // NN
-            vpTree.reset_search_metrics();
-
-            auto start = high_resolution_clock::now();
-            vpTree.nn(query.id);
-            auto end = high_resolution_clock::now();
-            searchTime = duration_cast<nanoseconds>
-(end - start).count();
-
-            totalNNTime += searchTime;
-            double pruningRateNN = vpTree.get_last_prunning_rate();
-            double visitedNodesNN = vpTree.get_last_visited_nodes();
-
-            // k-NN
-            vpTree.reset_search_metrics();
-
-            start = high_resolution_clock::now();
-            vpTree.knn(query.id, k);
-            end = high_resolution_clock::now();
-            searchTime = duration_cast<nanoseconds>
-(end - start).count();
+          // Nodos compactos de 16 bytes, sin cotas de capa
+          double compactBuildTime, compactPruningRate;
+          allResults.push_back(runVPExperiment<DYNAMIC_DIMS>(
+              dataset, queryPoints, k, "compacto", compactBuildTime,
+              compactPruningRate, VPLayout::Compact));
+
+          // Árbol completo por niveles con coordenadas en el nodo
+          double implicitBuildTime, implicitPruningRate;
+          allResults.push_back(runVPExperiment<DYNAMIC_DIMS>(
+              dataset, queryPoints, k, "implicito", implicitBuildTime,
+              implicitPruningRate, VPLayout::Implicit));
+
+          // kNN best-first sobre el mismo árbol: compara la poda con DFS
+          double bestFirstBuildTime, bestFirstPruningRate;
+          allResults.push_back(runVPExperiment<DYNAMIC_DIMS>(
+              dataset, queryPoints, k, "mejor_primero", bestFirstBuildTime,
+              bestFirstPruningRate, VPLayout::Pointer,
+              VPSearchOrder::BestFirst));
+
+          // Misma prueba con la dimensión fija en compilación
+          dispatchDims(dims, [&](auto fixedDims) {
+            constexpr size_t D = decltype(fixedDims)::value;
+            if constexpr (D != DYNAMIC_DIMS) {
+              double fixedBuildTime, fixedPruningRate;
+              allResults.push_back(runVPExperiment<D>(
+                  dataset, queryPoints, k, "fijo", fixedBuildTime,
+                  fixedPruningRate));
+            }
+          });
+        }
+      }
+    }
+  }
 
-            totalKNNTime += searchTime;
+  // Recall vs latencia sobre el tamaño mayor, como en kd_tree_stats
+  const int recallK = 10;
+  const vector<double> recallEpsilons = {0.25, 0.5, 1, 2};
+  const vector<size_t> distanceBudgets = {50, 100, 200, 500, 1000};
+  vector<vector<string>> recallResults;
 
-            totalPruningRate += (pruningRateNN + vpTree.get_last_prunning_rate()) / 2.0;
-            totalVisitedNodes += (visitedNodesNN + vpTree.get_last_visited_nodes()) / 2.0;
-          }
+  for (int dims : dimensionsToTest) {
+    if (dims > (int)baseData.dims())
+      continue;
 
-          double avgNN = totalNNTime / queryPoints.size();
-          double avgKNN = totalKNNTime / queryPoints.size();
-          double avgPruningRate = totalPruningRate / queryPoints.size();
-          double avgVisitedNodes = totalVisitedNodes / queryPoints.size();
+    int dataSize = min<int>(dataSizes.back(), baseData.size());
+    DatasetView dataset = baseData.view(dataSize, dims);
 
-          allPruningRates.push_back(avgPruningRate);
+    vector<PointView> queryPoints;
+    int startIdx = dataSize / 2;
+    int endIdx = min(startIdx + searchCounts.back(), dataSize);
+    for (int i = startIdx; i < endIdx; i++)
+      queryPoints.push_back(dataset[i]);
 
-          // Estadisticas globales
-          double avgPartitionRadius = vpTree.get_average_partition_radius();
-          long totalDistanceCalls = vpTree.get_total_distance_calls();
-
-          // Guardar resultados
-          allResults.push_back(
-              {to_string(dims),
-               to_string(dataSize),
-               to_string(queryPoints.size()),
-               to_string(k),
-               to_string(buildTime),
-               to_string(totalNNTime),
-               to_string(avgNN),
-               to_string(totalKNNTime),
-               to_string(avgKNN),
-               to_string(vpTree.get_depth()),
-               to_string(avgPruningRate),
-               to_string(totalDistanceCalls),
-               to_string(avgVisitedNodes),
-               to_string(avgPartitionRadius),
-               to_string(vpTree.estimatedMemoryBytes / 1024.0)});
-
-          cout << "  [VP-Tree] Dims: " << dims
-               << ", Tamaño: " << dataSize
-               << ", Poda: " << avgPruningRate
-               << ", Distancias: " << totalDistanceCalls
-               << ", Radio: " << avgPartitionRadius << endl;
-        }
-      }
-    }
+    for (auto &row : runVPRecallExperiments(dataset, queryPoints, recallK,
+                                            recallEpsilons, distanceBudgets))
+      recallResults.push_back(move(row));
   }
 
+  string recallFile = "recall_latencia_vptree.csv";
+  saveMetricsToCSV(recallFile, recallResults, RECALL_CSV_HEADERS);
+
   string resultsFile = "resultados_experimentos_vptree.csv";
 
   saveMetricsToCSV(resultsFile, allResults, headers);
@@ -375,9 +500,21 @@ int main() {
   config << "\n\n";
 
   config << "PARÁMETROS VP-TREE:\n";
-  config << "  - Selección VP: Aleatoria\n";
+  config << "  - Selección VP: Aleatoria (semilla " << VP_SEED << ")\n";
   config << "  - Métrica distancia: Euclidiana\n";
-  config << "  - Construcción: Estática (no incremental)\n\n";
+  config << "  - Nodos: punteros, compactos (16 bytes, variante compacto) e\n"
+            "    implícitos por niveles (variante implicito)\n";
+  config << "  - kNN: profundidad primero y best-first (variante "
+            "mejor_primero)\n";
+  config << "  - Construcción: Estática (no incremental)\n";
+  config << "  - Recall vs latencia (k = " << recallK
+         << "): exacto, aproximado con epsilon";
+  for (double epsilon : recallEpsilons)
+    config << " " << epsilon;
+  config << " y best-first con límite de";
+  for (size_t budget : distanceBudgets)
+    config << " " << budget;
+  config << " distancias\n\n";
 
   config << "Total experimentos: " << totalExperiments << "\n";
   config << "Resultados guardados en: " << resultsFile << "\n";
@@ -389,6 +526,7 @@ int main() {
   cout << "Resultados: " << resultsFile << endl;
   cout << "Resumen estadístico: resumen_estadistico_vptree.txt" << endl;
   cout << "Configuración: configuracion_experimentos_vptree.txt" << endl;
+  cout << "Recall vs latencia: " << recallFile << endl;
 
   return 0;
 }
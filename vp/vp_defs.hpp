@@ -1,14 +1,174 @@
 #pragma once
 
+#include <cmath>
 #include <cstddef>
-#include <memory>
+#include <cstdint>
+#include <limits>
+
+#include "split_mix.hpp"
+
+// Particiones más pequeñas se construyen en el hilo que las encuentra
+constexpr size_t VP_PARALLEL_CUTOFF = 4096;
+
+// Consultas que toma un hilo cada vez en knn_batch
+constexpr size_t VP_BATCH_GRAIN = 64;
+
+// Pointer: VPNode en la arena del árbol. Compact: VPCompactNode de 16 bytes
+// en un arreglo (menos de 2^32 - 1 objetos), sin las cotas near_lo / far_hi.
+// Implicit: árbol completo por niveles con las coordenadas del vantage point
+// en el propio nodo (ver VPImplicitCursor)
+enum class VPLayout { Pointer, Compact, Implicit };
+
+// Orden de visita de knn / knn_batch. DepthFirst baja primero por el lado
+// de la consulta; BestFirst visita siempre el subárbol pendiente con menor
+// cota inferior de distancia y para cuando esa cota supera la k-ésima
+enum class VPSearchOrder { DepthFirst, BestFirst };
+
+// Modo aproximado de una consulta (set_epsilon / set_distance_budget). Las
+// pruebas de poda usan u * shrink en vez de u, así solo se descarta lo que
+// no puede mejorar el resultado en más de un factor 1 + epsilon; al llegar
+// stats.distanceCalls a limit no se evalúan más distancias
+struct VPApprox {
+  double shrink{1}; // 1 / (1 + epsilon)
+  size_t limit{std::numeric_limits<size_t>::max()};
+  bool truncated{}; // la consulta se cortó por limit
+};
 
 struct VPNode {
   size_t id{};
   double r{};
-  std::unique_ptr<VPNode> near{}, far{};
-  VPNode(size_t id, double median, std::unique_ptr<VPNode> &&near, std::unique_ptr<VPNode> &&far)
-      : id(id), r(median), near(std::move(near)), far(std::move(far)) {};
+  // Cotas de distancia al vantage point de los subárboles: near en
+  // [near_lo, r], far en [r, far_hi]
+  double near_lo{}, far_hi{std::numeric_limits<double>::max()};
+  // Los nodos viven en la NodeArena del árbol
+  VPNode *near{}, *far{};
+  VPNode(size_t id, double median) : id(id), r(median) {}
+};
+
+// Nodo del índice persistido (save_index / load_index): el árbol en preorden
+// en un arreglo, con los hijos como posiciones dentro del mismo arreglo
+constexpr std::uint32_t VP_NO_CHILD = UINT32_MAX;
+
+struct VPFlatNode {
+  double r{};
+  double near_lo{}, far_hi{};
+  std::uint32_t id{}; // fila, como VPNode::id
+  std::uint32_t near{VP_NO_CHILD}, far{VP_NO_CHILD};
+  std::uint32_t pad{};
+};
+
+// Fila de 32 bits, radio en float redondeado hacia arriba e hijos como
+// posiciones en el arreglo de nodos
+struct VPCompactNode {
+  std::uint32_t id;
+  float r;
+  std::uint32_t near, far;
+};
+static_assert(sizeof(VPCompactNode) == 16);
+
+// Los recorridos de VP_tree son plantillas sobre estos cursores, así los
+// distintos formatos de nodo comparten el mismo código. near tiene
+// distancias <= r_hi() y far >= r_lo(); solo difieren si el radio se
+// guardó con menos precisión.
+struct VPNodeCursor {
+  const VPNode *node;
+
+  explicit operator bool() const { return node != nullptr; }
+  size_t id() const { return node->id; }
+  double r() const { return node->r; }
+  double r_hi() const { return node->r; }
+  double r_lo() const { return node->r; }
+  double near_lo() const { return node->near_lo; }
+  double far_hi() const { return node->far_hi; }
+  VPNodeCursor near() const { return {node->near}; }
+  VPNodeCursor far() const { return {node->far}; }
+};
+
+struct VPFlatCursor {
+  const VPFlatNode *nodes;
+  std::uint32_t i;
+
+  explicit operator bool() const { return i != VP_NO_CHILD; }
+  size_t id() const { return nodes[i].id; }
+  double r() const { return nodes[i].r; }
+  double r_hi() const { return nodes[i].r; }
+  double r_lo() const { return nodes[i].r; }
+  double near_lo() const { return nodes[i].near_lo; }
+  double far_hi() const { return nodes[i].far_hi; }
+  VPFlatCursor near() const { return {nodes, nodes[i].near}; }
+  VPFlatCursor far() const { return {nodes, nodes[i].far}; }
+};
+
+// El radio float es >= el real, así el float anterior es <= el real
+struct VPCompactCursor {
+  const VPCompactNode *nodes;
+  std::uint32_t i;
+
+  explicit operator bool() const { return i != VP_NO_CHILD; }
+  size_t id() const { return nodes[i].id; }
+  double r() const { return nodes[i].r; }
+  double r_hi() const { return nodes[i].r; }
+  double r_lo() const { return std::nextafter(nodes[i].r, 0.0f); }
+  double near_lo() const { return 0; }
+  double far_hi() const { return std::numeric_limits<double>::max(); }
+  VPCompactCursor near() const { return {nodes, nodes[i].near}; }
+  VPCompactCursor far() const { return {nodes, nodes[i].far}; }
+};
+
+// Nodo i con hijos en 2i+1 (near) y 2i+2 (far), sin punteros. Cada registro
+// es [r, near_lo, far_hi, coordenadas del vantage point], así la distancia
+// se calcula sin ir a la fila del dataset; la fila solo se lee al aceptar
+// un candidato
+constexpr size_t VP_IMPLICIT_HEADER = 3;
+
+struct VPImplicitCursor {
+  const double *nodes;
+  const std::uint32_t *rows;
+  size_t stride;
+  size_t n;
+  size_t i;
+
+  explicit operator bool() const { return i < n; }
+  size_t id() const { return rows[i]; }
+  double r() const { return nodes[i * stride]; }
+  double r_hi() const { return r(); }
+  double r_lo() const { return r(); }
+  double near_lo() const { return nodes[i * stride + 1]; }
+  double far_hi() const { return nodes[i * stride + 2]; }
+  const double *coords() const {
+    return nodes + i * stride + VP_IMPLICIT_HEADER;
+  }
+  VPImplicitCursor near() const { return {nodes, rows, stride, n, 2 * i + 1}; }
+  VPImplicitCursor far() const { return {nodes, rows, stride, n, 2 * i + 2}; }
+};
+
+// Índice persistido (versión 1), en el orden de bytes de la máquina:
+// cabecera y secciones nodes, ids y opcionalmente features (matriz rows x
+// stride) alineadas a DATASET_ALIGNMENT. checksum cubre las secciones;
+// fingerprint es la huella del DatasetView sobre el que se construyó.
+constexpr char VP_INDEX_MAGIC[8] = {'V', 'P', 'I', 'N', 'D', 'E', 'X', '\0'};
+constexpr std::uint32_t VP_INDEX_VERSION = 1;
+constexpr std::uint32_t VP_INDEX_FEATURES = 1;
+
+struct VPIndexHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t flags;
+  std::uint64_t rows;
+  std::uint64_t dims;
+  std::uint64_t stride; // doubles por fila en features
+  std::uint64_t seed;
+  std::uint64_t radius_sum;
+  std::uint64_t fingerprint;
+  std::uint64_t checksum;
+  std::uint64_t nodes_offset;
+  std::uint64_t ids_offset;
+  std::uint64_t features_offset; // 0 sin VP_INDEX_FEATURES
+};
+
+// Métricas de construcción; las de búsqueda van en SearchStats
+struct VPMetrics {
+  size_t radius_sum{};
 };
 
 struct VPNeig {
@@ -2,9 +2,15 @@
 #include "rapidcsv.h"
 #include "vp_defs.hpp"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
+#include <cstring>
 #include <exception>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
 #include <limits>
 #include <memory>
 #include <numeric>
@@ -20,15 +26,28 @@
 //   return distances[idx(i, j)];
 // }
 
-inline double VP_tree::euclidsq_dist(size_t i, size_t j) const {
-  auto &a = feat_vecs[i],
-       &b = feat_vecs[j];
-  double sum = 0.0;
-  for (size_t k = 0; k < a.size(); k++) {
-    double diff = a[k] - b[k];
-    sum += diff * diff;
-  }
-  return std::sqrt(sum);
+static double
+elapsed_ns(std::chrono::high_resolution_clock::time_point start) {
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+      .count();
+}
+
+template <size_t D>
+inline double VP_tree<D>::euclidsq_to(size_t i, const double *q) const {
+  return squaredDistance<D>(data.row(i), q, dims);
+}
+
+template <size_t D>
+inline double VP_tree<D>::euclidsq_dist(size_t i, size_t j) const {
+  return euclidsq_to(i, data.row(j));
+}
+
+// Solo donde se necesita la desigualdad triangular; para ordenar o comparar
+// contra un radio basta la distancia al cuadrado
+template <size_t D>
+inline double VP_tree<D>::euclid_to(const double *v, const double *q) const {
+  return std::sqrt(squaredDistance<D>(v, q, dims));
 }
 
 // void VP_tree::init_distances(std::string &dist_path) {
@@ -65,225 +84,864 @@ inline double VP_tree::euclidsq_dist(size_t i, size_t j) const {
 //   std::println("Distancias cargadas");
 // }
 
-void VP_tree::build() {
-  root = _build(points, 0, nobjs);
+template <size_t D>
+void VP_tree<D>::attach() {
+  nobjs = data.size();
+  dims = D != DYNAMIC_DIMS ? D : data.dims();
 
-  estimatedMemoryBytes =
-      nobjs * (sizeof(VPNode) + 2 * sizeof(std::unique_ptr<VPNode>));
-}
+  if (D != DYNAMIC_DIMS && !data.empty() && data.dims() < D) {
+    std::cerr << "Error: los puntos tienen " << data.dims()
+              << " dimensiones, el árbol espera " << D << std::endl;
+    nobjs = 0;
+  }
 
-std::unique_ptr<VPNode> VP_tree::_build(std::vector<int> &objs,
-                                        size_t i, size_t j) {
-  if (i >= j)
-    return {};
+  points.resize(nobjs);
+  std::iota(points.begin(), points.end(), 0);
+}
 
-  if (i + 1 == j)
-    return std::make_unique<VPNode>(objs[i], 0, nullptr, nullptr);
+template <size_t D>
+void VP_tree<D>::build(bool shell_bounds, VPLayout layout) {
+  if (layout != VPLayout::Pointer && nobjs >= VP_NO_CHILD) {
+    std::cerr << "Aviso: " << nobjs
+              << " objetos no caben en índices de 32 bits, se usan punteros"
+              << std::endl;
+    layout = VPLayout::Pointer;
+  }
 
-  std::uniform_int_distribution<> int_dist(i, j - 1);
+  // Los nodos compactos no guardan las cotas
+  keep_bounds = shell_bounds && layout != VPLayout::Compact;
+  scratch.resize(nobjs);
+
+  // Un índice cargado se descarta; su mapeo sigue vivo si data apunta a él
+  flat_nodes = {};
+  compact_nodes = {};
+  implicit_nodes = {};
+  implicit_rows = {};
+  arena.clear();
+  root = nullptr;
+
+  size_t radius_sum = 0;
+  if (layout == VPLayout::Implicit) {
+    implicit_nodes.assign(nobjs * implicit_stride(), 0.0);
+    implicit_rows.assign(nobjs, 0);
+    _build_implicit(points, 0, nobjs, 0, build_threads, radius_sum);
+  } else {
+    auto slots = arena.take(nobjs);
+    root = _build(points, 0, nobjs, build_threads, radius_sum, slots);
+  }
+  metrics.radius_sum += radius_sum;
+
+  scratch = {};
+
+  if (layout == VPLayout::Compact && root) {
+    compact_nodes.reserve(nobjs);
+    _compact(root, compact_nodes);
+    arena.clear();
+    root = nullptr;
+    estimatedMemoryBytes = compact_nodes.size() * sizeof(VPCompactNode);
+  } else if (layout == VPLayout::Implicit) {
+    estimatedMemoryBytes = implicit_nodes.size() * sizeof(double) +
+                           implicit_rows.size() * sizeof(std::uint32_t);
+  } else {
+    estimatedMemoryBytes = arena.bytes();
+  }
+}
 
-  auto piv = int_dist(eng);
+template <size_t D>
+typename VP_tree<D>::Partition
+VP_tree<D>::_partition(std::vector<int> &objs, size_t i, size_t j,
+                       size_t split, unsigned threads) {
+  // Vantage point aleatorio: el objeto con menor hash bajo el flujo propio
+  // del subproblema. Depende del conjunto [i, j) y no de su orden, que
+  // varía según si la selección previa fue serial o paralela
+  auto salt = SplitMix64(seed, i, j)();
+  size_t piv = i;
+  auto piv_hash = std::numeric_limits<std::uint64_t>::max();
+  for (size_t k = i; k < j; ++k) {
+    auto h = SplitMix64(salt, objs[k], 0)();
+    if (h < piv_hash) {
+      piv_hash = h;
+      piv = k;
+    }
+  }
   std::swap(objs[piv], objs[j - 1]);
 
   auto piv_obj = objs[j - 1];
-  size_t median = (j + i - 1) / 2;
 
-  std::nth_element(objs.begin() + i, objs.begin() + median, objs.begin() + j - 1,
-                   [&](int a, int b) { return euclidsq_dist(a, piv_obj) <
-                                              euclidsq_dist(b, piv_obj); });
+  auto fill_scratch = [&](size_t lo, size_t hi) {
+    for (size_t k = lo; k < hi; ++k)
+      scratch[k] = {euclidsq_dist(objs[k], piv_obj), objs[k]};
+  };
+
+  if (threads > 1 && j - i > VP_PARALLEL_CUTOFF) {
+    size_t chunk = (j - 1 - i + threads - 1) / threads;
+    runParallel(threads, [&](size_t t) {
+      size_t lo = std::min(j - 1, i + t * chunk);
+      fill_scratch(lo, std::min(j - 1, lo + chunk));
+    });
+  } else {
+    fill_scratch(i, j - 1);
+  }
+
+  // Sin far (split == j - 1, solo en el layout implícito) el radio es la
+  // mayor distancia de near
+  double distance;
+  if (split < j - 1) {
+    parallelNthElement(scratch.begin() + i, scratch.begin() + split,
+                       scratch.begin() + j - 1, std::less<>(), threads);
+    distance = std::sqrt(scratch[split].first);
+  } else {
+    distance = std::sqrt(
+        std::max_element(scratch.begin() + i, scratch.begin() + split)->first);
+  }
 
-  auto distance = euclidsq_dist(piv_obj, objs[median]);
+  for (size_t k = i; k < j - 1; ++k)
+    objs[k] = scratch[k].second;
+
+  double near_lo = 0, far_hi = std::numeric_limits<double>::max();
+  if (keep_bounds) {
+    if (split > i)
+      near_lo = std::sqrt(std::min_element(scratch.begin() + i,
+                                           scratch.begin() + split)->first);
+    if (split < j - 1)
+      far_hi = std::sqrt(std::max_element(scratch.begin() + split,
+                                          scratch.begin() + j - 1)->first);
+  }
 
-  metrics.radius_sum += distance;
+  return {piv_obj, distance, near_lo, far_hi};
+}
+
+template <size_t D>
+VPNode *VP_tree<D>::_build(std::vector<int> &objs, size_t i, size_t j,
+                           unsigned threads, size_t &radius_sum,
+                           NodeArena<VPNode>::Slots &slots) {
+  if (i >= j)
+    return nullptr;
+
+  if (i + 1 == j)
+    return slots.make(objs[i], 0);
+
+  size_t median = (j + i - 1) / 2;
+  auto part = _partition(objs, i, j, median, threads);
+  radius_sum += part.r;
 
   // Aparentemente la posicion del pivot se puede ignorar/descarta
   // std::swap(objs[piv], objs[median]);
 
-  return std::make_unique<VPNode>(piv_obj,
-                                  distance,
-                                  _build(objs, i, median),
-                                  _build(objs, median, j - 1));
+  // Cada subárbol ocupa el tramo de slots de su rango de objs y el nodo va
+  // al final (orden de construcción en serie): las tareas paralelas no se
+  // sincronizan y el resultado no depende del número de hilos
+  auto near_slots = slots.split(median - i);
+  auto far_slots = slots.split(j - 1 - median);
+  VPNode *node = slots.make(part.vp, part.r);
+  node->near_lo = part.near_lo;
+  node->far_hi = part.far_hi;
+
+  if (threads > 1 && j - i > VP_PARALLEL_CUTOFF) {
+    size_t near_radius_sum = 0;
+    auto near_task = std::async(std::launch::async, [&] {
+      return _build(objs, i, median, threads / 2, near_radius_sum,
+                    near_slots);
+    });
+    node->far = _build(objs, median, j - 1, threads - threads / 2, radius_sum,
+                       far_slots);
+    node->near = near_task.get();
+    radius_sum += near_radius_sum;
+  } else {
+    node->near = _build(objs, i, median, 1, radius_sum, near_slots);
+    node->far = _build(objs, median, j - 1, 1, radius_sum, far_slots);
+  }
+
+  return node;
 }
 
-bool VP_tree::puntal_search(size_t id) {
-  if (id > nobjs)
-    return false;
+// Como _build, pero near recibe leftSubtreeSize(j - i) objetos: el árbol
+// queda completo y se guarda por niveles en pos, 2 pos + 1 y 2 pos + 2
+template <size_t D>
+void VP_tree<D>::_build_implicit(std::vector<int> &objs, size_t i, size_t j,
+                                 size_t pos, unsigned threads,
+                                 size_t &radius_sum) {
+  if (i >= j)
+    return;
 
-  VPNode *node = root.get();
-  while (node) {
-    std::println("{}", node->id);
-    if (node->id == id)
-      return true;
+  double *record = implicit_nodes.data() + pos * implicit_stride();
 
-    if (euclidsq_dist(id, node->id) < node->r)
-      node = node->near.get();
-    else
-      node = node->far.get();
+  if (i + 1 == j) {
+    record[0] = 0;
+    record[1] = 0;
+    record[2] = std::numeric_limits<double>::max();
+    std::copy_n(data.row(objs[i]), dims, record + VP_IMPLICIT_HEADER);
+    implicit_rows[pos] = objs[i];
+    return;
   }
 
-  return false;
+  size_t split = i + leftSubtreeSize(j - i);
+  auto part = _partition(objs, i, j, split, threads);
+  radius_sum += part.r;
+
+  record[0] = part.r;
+  record[1] = part.near_lo;
+  record[2] = part.far_hi;
+  std::copy_n(data.row(part.vp), dims, record + VP_IMPLICIT_HEADER);
+  implicit_rows[pos] = part.vp;
+
+  if (threads > 1 && j - i > VP_PARALLEL_CUTOFF) {
+    size_t near_radius_sum = 0;
+    auto near_task = std::async(std::launch::async, [&] {
+      _build_implicit(objs, i, split, 2 * pos + 1, threads / 2,
+                      near_radius_sum);
+    });
+    _build_implicit(objs, split, j - 1, 2 * pos + 2, threads - threads / 2,
+                    radius_sum);
+    near_task.get();
+    radius_sum += near_radius_sum;
+  } else {
+    _build_implicit(objs, i, split, 2 * pos + 1, 1, radius_sum);
+    _build_implicit(objs, split, j - 1, 2 * pos + 2, 1, radius_sum);
+  }
 }
 
-void VP_tree::print_tree(VPNode *node) {
+template <size_t D>
+bool VP_tree<D>::puntal_search(size_t id) const {
+  size_t row = data.rowOf(id);
+  if (row == DatasetView::npos)
+    return false;
+
+  return visit_root([&](auto node) {
+    while (node) {
+      std::println("{}", data.id(node.id()));
+      if (node.id() == row)
+        return true;
+
+      if (euclidsq_dist(row, node.id()) < node.r() * node.r())
+        node = node.near();
+      else
+        node = node.far();
+    }
+
+    return false;
+  });
+}
+
+template <size_t D>
+template <class Cursor>
+void VP_tree<D>::print_tree(Cursor node) {
   if (!node)
     return;
 
-  std::print("{} median: {} ", node->id, node->r);
-  if (!node->near && !node->far)
+  std::print("{} median: {} ", data.id(node.id()), node.r());
+  if (!node.near() && !node.far())
     std::print("(l) ");
 
   std::println();
 
-  print_tree(node->near.get());
-  print_tree(node->far.get());
+  print_tree(node.near());
+  print_tree(node.far());
 }
 
-void VP_tree::print_tree() {
-  print_tree(root.get());
+template <size_t D>
+void VP_tree<D>::print_tree() {
+  visit_root([&](auto node) { print_tree(node); });
 }
 
-void VP_tree::reset_metrics() {
+template <size_t D>
+void VP_tree<D>::reset_metrics() {
   metrics = {};
 }
 
-void VP_tree::reset_search_metrics() {
-  metrics.lastVisitedNodes = 0;
-  // metrics.totalDistanceCalls
-}
-
-double VP_tree::get_last_prunning_rate() {
-  if (nobjs == 0)
+template <size_t D>
+double VP_tree<D>::get_prunning_rate(const SearchStats &stats) const {
+  if (nobjs == 0 || stats.queries == 0)
     return 0;
-  double nodesNotVisited = nobjs - metrics.lastVisitedNodes;
-  return nodesNotVisited / nobjs;
-}
-
-size_t VP_tree::get_last_visited_nodes() {
-  return metrics.lastVisitedNodes;
+  double visited_per_query =
+      static_cast<double>(stats.visitedNodes) / stats.queries;
+  return (nobjs - visited_per_query) / nobjs;
 }
 
-size_t VP_tree::get_total_distance_calls() {
-  return metrics.totalDistanceCalls;
-}
-
-double VP_tree::get_average_partition_radius() {
+template <size_t D>
+double VP_tree<D>::get_average_partition_radius() const {
   if (nobjs == 0)
     return 0;
 
   return static_cast<double>(metrics.radius_sum) / nobjs;
 }
 
-size_t VP_tree::get_depth() const {
-  return get_depth(root.get());
+template <size_t D>
+size_t VP_tree<D>::get_depth() const {
+  return visit_root([&](auto node) { return _depth(node); });
+}
+
+template <size_t D>
+size_t VP_tree<D>::get_depth(VPNode *node) const {
+  return _depth(VPNodeCursor{node});
 }
 
-size_t VP_tree::get_depth(VPNode *node) const {
+template <size_t D>
+template <class Cursor>
+size_t VP_tree<D>::_depth(Cursor node) const {
   if (!node)
     return 0;
 
-  return 1 + std::max(get_depth(node->near.get()),
-                      get_depth(node->far.get()));
+  return 1 + std::max(_depth(node.near()), _depth(node.far()));
 }
 
-void VP_tree::_radial_search(VPNode *node, size_t id, double r, std::vector<int> &objs) {
+template <size_t D>
+template <class Cursor>
+void VP_tree<D>::_radial_search(Cursor node, size_t row, double r,
+                                std::vector<int> &objs,
+                                SearchStats &stats) const {
   if (!node)
     return;
 
-  if (euclidsq_dist(node->id, id) <= r)
-    objs.push_back(node->id);
+  stats.visitedNodes++;
+  stats.distanceCalls++;
+
+  double dsq = squaredDistance<D>(vantage(node), data.row(row), dims);
+
+  if (dsq <= r * r)
+    objs.push_back(data.id(node.id()));
 
-  if (euclidsq_dist(node->id, id) <= node->r + r)
-    _radial_search(node->near.get(), id, r, objs);
+  if (dsq <= (node.r_hi() + r) * (node.r_hi() + r))
+    _radial_search(node.near(), row, r, objs, stats);
   else
-    _radial_search(node->far.get(), id, r, objs);
+    _radial_search(node.far(), row, r, objs, stats);
 }
 
-std::vector<int> VP_tree::radial_search(size_t id, double r) {
+template <size_t D>
+std::vector<int> VP_tree<D>::radial_search(size_t id, double r,
+                                           SearchStats *stats) const {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  size_t row = data.rowOf(id);
+  if (row == DatasetView::npos)
+    return {};
+
+  SearchStats local;
   std::vector<int> objs{};
-  _radial_search(root.get(), id, r, objs);
+  visit_root([&](auto node) { _radial_search(node, row, r, objs, local); });
+
+  if (stats) {
+    local.queries = 1;
+    local.searchTimeNs = elapsed_ns(start);
+    *stats += local;
+  }
 
   return objs;
 }
 
-void VP_tree::_knn(VPNode *node, size_t ref_id, double &u, NodeMaxHeap &heap, size_t n) {
+template <size_t D>
+template <class Cursor>
+void VP_tree<D>::_knn(Cursor node, const double *q, double &u,
+                      NodeMaxHeap &heap, size_t n, SearchStats &stats,
+                      VPApprox &approx) const {
   if (!node)
     return;
+  if (stats.distanceCalls >= approx.limit) {
+    approx.truncated = true;
+    return;
+  }
 
-  metrics.lastVisitedNodes++;
-  metrics.totalNodesVisited++;
-  metrics.totalDistanceCalls++;
+  stats.visitedNodes++;
+  stats.distanceCalls++;
 
-  auto d = euclidsq_dist(node->id, ref_id);
+  auto d = euclid_to(vantage(node), q);
 
-  if (d < u) {
+  if (heap.size() < n || d < u) {
     if (heap.size() == n)
       heap.pop();
-    heap.push({node->id, d});
+    heap.push({node.id(), d});
 
-    u = heap.top().d;
+    // u solo se acota cuando ya hay n candidatos
+    if (heap.size() == n)
+      u = heap.top().d;
   }
 
-  if (d < node->r) {
-    _knn(node->near.get(), ref_id, u, heap, n);
-    if (d + u >= node->r)
-      _knn(node->far.get(), ref_id, u, heap, n);
+  // Radio de poda; u cambia tras bajar por el primer hijo
+  auto ru = [&] { return u * approx.shrink; };
+
+  if (d < node.r()) {
+    if (d + ru() >= node.near_lo())
+      _knn(node.near(), q, u, heap, n, stats, approx);
+    if (d + ru() >= node.r_lo() && d - ru() <= node.far_hi())
+      _knn(node.far(), q, u, heap, n, stats, approx);
   } else {
-    _knn(node->far.get(), ref_id, u, heap, n);
-    if (d - u <= node->r)
-      _knn(node->near.get(), ref_id, u, heap, n);
+    if (d - ru() <= node.far_hi())
+      _knn(node.far(), q, u, heap, n, stats, approx);
+    if (d - ru() <= node.r_hi() && d + ru() >= node.near_lo())
+      _knn(node.near(), q, u, heap, n, stats, approx);
   }
 }
 
-std::vector<int> VP_tree::knn(size_t ref_id, size_t n) {
+// Cola de subárboles pendientes ordenada por la cota inferior de la
+// distancia de sus objetos a q: la del padre, ajustada con el intervalo de
+// distancias al vantage point de cada hijo (near en [near_lo, r_hi], far en
+// [r_lo, far_hi]). Desde cada subárbol sacado de la cola se baja por el hijo
+// de menor cota y el otro se encola, así solo la mitad de los nodos pasa
+// por el heap.
+template <size_t D>
+template <class Cursor>
+void VP_tree<D>::_knn_best_first(Cursor root, const double *q, double &u,
+                                 NodeMaxHeap &heap, size_t n,
+                                 SearchStats &stats, VPApprox &approx) const {
+  struct Pending {
+    double lb;
+    Cursor node;
+  };
+  auto farther = [](const Pending &a, const Pending &b) { return a.lb > b.lb; };
+  std::priority_queue<Pending, std::vector<Pending>, decltype(farther)>
+      pending(farther);
+
+  auto open = [&](double b) {
+    return heap.size() < n || b <= u * approx.shrink;
+  };
+
+  if (root)
+    pending.push({0, root});
+
+  while (!pending.empty()) {
+    auto [lb, node] = pending.top();
+    pending.pop();
+    // Los demás pendientes están al menos igual de lejos
+    if (!open(lb))
+      break;
+
+    while (node) {
+      if (stats.distanceCalls >= approx.limit) {
+        approx.truncated = true;
+        return;
+      }
+
+      stats.visitedNodes++;
+      stats.distanceCalls++;
+
+      auto d = euclid_to(vantage(node), q);
+
+      if (heap.size() < n || d < u) {
+        if (heap.size() == n)
+          heap.pop();
+        heap.push({node.id(), d});
+
+        if (heap.size() == n)
+          u = heap.top().d;
+      }
+
+      Pending near{std::max({lb, node.near_lo() - d, d - node.r_hi()}),
+                   node.near()};
+      Pending far{std::max({lb, node.r_lo() - d, d - node.far_hi()}),
+                  node.far()};
+      if (far.lb < near.lb)
+        std::swap(near, far);
+
+      // near es ahora el hijo más cercano: se sigue por él
+      if (far.node && open(far.lb))
+        pending.push(far);
+      if (!near.node || !open(near.lb))
+        break;
+      lb = near.lb;
+      node = near.node;
+    }
+  }
+}
+
+template <size_t D>
+VPApprox VP_tree<D>::_approx_for(const SearchStats &stats) const {
+  VPApprox approx;
+  approx.shrink = 1 / (1 + epsilon);
+  if (distance_budget)
+    approx.limit = stats.distanceCalls + distance_budget;
+  return approx;
+}
+
+template <size_t D>
+void VP_tree<D>::_knn_query(const double *q, double &u, NodeMaxHeap &heap,
+                            size_t n, SearchStats &stats) const {
+  if (n == 0)
+    return;
+
+  auto approx = _approx_for(stats);
+  visit_root([&](auto node) {
+    if (search_order == VPSearchOrder::BestFirst)
+      _knn_best_first(node, q, u, heap, n, stats, approx);
+    else
+      _knn(node, q, u, heap, n, stats, approx);
+  });
+  if (approx.truncated)
+    stats.truncatedQueries++;
+}
+
+template <size_t D>
+std::vector<int> VP_tree<D>::knn(size_t ref_id, size_t n,
+                                 SearchStats *stats) const {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  size_t row = data.rowOf(ref_id);
+  if (row == DatasetView::npos)
+    return {};
+
+  SearchStats local;
   NodeMaxHeap heap;
   auto u = std::numeric_limits<double>::max();
 
-  _knn(root.get(), ref_id, u, heap, n);
+  _knn_query(data.row(row), u, heap, n, local);
 
   std::vector<int> objs;
   objs.reserve(n);
 
   while (!heap.empty()) {
-    objs.push_back(heap.top().id);
+    objs.push_back(data.id(heap.top().id));
     heap.pop();
   }
 
+  if (stats) {
+    local.queries = 1;
+    local.searchTimeNs = elapsed_ns(start);
+    *stats += local;
+  }
+
   return objs;
 }
 
-int VP_tree::nn(size_t ref_id) {
-  size_t best_id = ref_id;
+template <size_t D>
+void VP_tree<D>::knn_batch(const double *queries, size_t nq, size_t k,
+                           int *out_ids, double *out_dists,
+                           unsigned threads, SearchStats *stats) const {
+  if (k == 0)
+    return;
+
+  threads = resolveThreads(threads);
+  std::vector<SearchStats> worker_stats(threads);
+
+  parallelFor(nq, VP_BATCH_GRAIN, threads,
+              [&](size_t begin, size_t end, size_t worker) {
+                auto start = std::chrono::high_resolution_clock::now();
+                for (size_t qi = begin; qi < end; ++qi) {
+                  NodeMaxHeap heap;
+                  auto u = std::numeric_limits<double>::max();
+
+                  _knn_query(queries + qi * dims, u, heap, k,
+                             worker_stats[worker]);
+
+                  int *ids = out_ids + qi * k;
+                  double *dists = out_dists + qi * k;
+
+                  size_t found = heap.size();
+                  for (size_t i = found; i-- > 0; heap.pop()) {
+                    ids[i] = data.id(heap.top().id);
+                    dists[i] = heap.top().d;
+                  }
+                  for (size_t i = found; i < k; ++i) {
+                    ids[i] = -1;
+                    dists[i] = std::numeric_limits<double>::infinity();
+                  }
+                }
+                worker_stats[worker].queries += end - begin;
+                worker_stats[worker].searchTimeNs += elapsed_ns(start);
+              });
+
+  if (stats)
+    for (auto &s : worker_stats)
+      *stats += s;
+}
+
+template <size_t D>
+int VP_tree<D>::nn(size_t ref_id, SearchStats *stats) const {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  size_t row = data.rowOf(ref_id);
+  if (row == DatasetView::npos)
+    return -1;
+
+  SearchStats local;
+  size_t best_id = row;
   double best_dist = std::numeric_limits<double>::max();
 
-  _nn(root.get(), ref_id, best_id, best_dist);
-  return best_id;
+  auto approx = _approx_for(local);
+  visit_root([&](auto node) {
+    _nn(node, data.row(row), best_id, best_dist, local, approx);
+  });
+  if (approx.truncated)
+    local.truncatedQueries++;
+
+  if (stats) {
+    local.queries = 1;
+    local.searchTimeNs = elapsed_ns(start);
+    *stats += local;
+  }
+
+  return data.id(best_id);
 }
 
-void VP_tree::_nn(VPNode *node, size_t ref_id,
-                  size_t &best_id, double &best_dist) {
+template <size_t D>
+template <class Cursor>
+void VP_tree<D>::_nn(Cursor node, const double *q, size_t &best_id,
+                     double &best_dist, SearchStats &stats,
+                     VPApprox &approx) const {
   if (!node)
     return;
+  if (stats.distanceCalls >= approx.limit) {
+    approx.truncated = true;
+    return;
+  }
 
-  metrics.lastVisitedNodes++;
-  metrics.totalNodesVisited++;
-  metrics.totalDistanceCalls++;
+  stats.visitedNodes++;
+  stats.distanceCalls++;
 
-  double d = euclidsq_dist(node->id, ref_id);
+  double d = euclid_to(vantage(node), q);
 
   if (d < best_dist) {
     best_dist = d;
-    best_id = node->id;
+    best_id = node.id();
   }
 
-  double r = node->r;
+  auto rb = [&] { return best_dist * approx.shrink; };
 
-  if (d < r) {
-    _nn(node->near.get(), ref_id, best_id, best_dist);
-    if (d + best_dist >= r)
-      _nn(node->far.get(), ref_id, best_id, best_dist);
+  if (d < node.r()) {
+    if (d + rb() >= node.near_lo())
+      _nn(node.near(), q, best_id, best_dist, stats, approx);
+    if (d + rb() >= node.r_lo() && d - rb() <= node.far_hi())
+      _nn(node.far(), q, best_id, best_dist, stats, approx);
   } else {
-    _nn(node->far.get(), ref_id, best_id, best_dist);
-    if (d - best_dist <= r)
-      _nn(node->near.get(), ref_id, best_id, best_dist);
+    if (d - rb() <= node.far_hi())
+      _nn(node.far(), q, best_id, best_dist, stats, approx);
+    if (d - rb() <= node.r_hi() && d + rb() >= node.near_lo())
+      _nn(node.near(), q, best_id, best_dist, stats, approx);
   }
 }
+
+template <size_t D>
+std::uint32_t VP_tree<D>::_flatten(const VPNode *node,
+                                   std::vector<VPFlatNode> &out) const {
+  if (!node)
+    return VP_NO_CHILD;
+
+  auto pos = static_cast<std::uint32_t>(out.size());
+  out.push_back({node->r, node->near_lo, node->far_hi,
+                 static_cast<std::uint32_t>(node->id)});
+
+  auto near = _flatten(node->near, out);
+  auto far = _flatten(node->far, out);
+  out[pos].near = near;
+  out[pos].far = far;
+  return pos;
+}
+
+// Mismo orden que la arena: subárboles y luego el nodo
+template <size_t D>
+std::uint32_t VP_tree<D>::_compact(const VPNode *node,
+                                   std::vector<VPCompactNode> &out) const {
+  if (!node)
+    return VP_NO_CHILD;
+
+  auto near = _compact(node->near, out);
+  auto far = _compact(node->far, out);
+
+  // Redondeo hacia arriba: r_hi no excluye objetos de near y el float
+  // anterior (r_lo) sigue siendo cota inferior de far
+  float r = static_cast<float>(node->r);
+  if (r < node->r)
+    r = std::nextafter(r, std::numeric_limits<float>::infinity());
+
+  out.push_back({static_cast<std::uint32_t>(node->id), r, near, far});
+  return static_cast<std::uint32_t>(out.size() - 1);
+}
+
+static size_t align_up(size_t bytes) {
+  return (bytes + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT *
+         DATASET_ALIGNMENT;
+}
+
+template <size_t D>
+bool VP_tree<D>::save_index(const std::string &path,
+                            bool with_features) const {
+  if (!root && flat_nodes.empty()) {
+    std::cerr << "Error: solo se puede guardar un árbol construido con "
+                 "VPLayout::Pointer o cargado con load_index"
+              << std::endl;
+    return false;
+  }
+  if (nobjs >= VP_NO_CHILD) {
+    std::cerr << "Error: el índice admite hasta " << VP_NO_CHILD - 1
+              << " objetos" << std::endl;
+    return false;
+  }
+
+  std::vector<VPFlatNode> flattened;
+  std::span<const VPFlatNode> nodes = flat_nodes;
+  if (root) {
+    flattened.reserve(nobjs);
+    _flatten(root, flattened);
+    nodes = flattened;
+  }
+
+  std::vector<int> ids(nobjs);
+  for (size_t r = 0; r < nobjs; ++r)
+    ids[r] = data.id(r);
+
+  // Filas con el mismo padding que un Dataset, para proyectarlas alineadas
+  size_t stride =
+      (data.dims() + DATASET_ROW_PAD - 1) / DATASET_ROW_PAD * DATASET_ROW_PAD;
+  std::vector<double> features;
+  if (with_features) {
+    features.assign(nobjs * stride, 0.0);
+    for (size_t r = 0; r < nobjs; ++r)
+      std::copy_n(data.row(r), data.dims(), features.data() + r * stride);
+  }
+
+  VPIndexHeader h{};
+  std::memcpy(h.magic, VP_INDEX_MAGIC, sizeof(h.magic));
+  h.version = VP_INDEX_VERSION;
+  h.flags = with_features ? VP_INDEX_FEATURES : 0;
+  h.rows = nobjs;
+  h.dims = data.dims();
+  h.stride = stride;
+  h.seed = seed;
+  h.radius_sum = metrics.radius_sum;
+  h.fingerprint = data.fingerprint();
+  h.nodes_offset = align_up(sizeof(h));
+  h.ids_offset = align_up(h.nodes_offset + nodes.size_bytes());
+  h.features_offset =
+      with_features ? align_up(h.ids_offset + ids.size() * sizeof(int)) : 0;
+
+  h.checksum = checksum(nodes.data(), nodes.size_bytes());
+  h.checksum = checksum(ids.data(), ids.size() * sizeof(int), h.checksum);
+  h.checksum = checksum(features.data(), features.size() * sizeof(double),
+                        h.checksum);
+
+  std::ofstream out(path, std::ios::binary);
+  if (!out.is_open()) {
+    std::cerr << "Error: No se pudo crear el archivo " << path << std::endl;
+    return false;
+  }
+
+  size_t written = 0;
+  auto put = [&](size_t offset, const void *bytes, size_t count) {
+    static const char zeros[DATASET_ALIGNMENT] = {};
+    out.write(zeros, offset - written);
+    out.write(static_cast<const char *>(bytes), count);
+    written = offset + count;
+  };
+  put(0, &h, sizeof(h));
+  put(h.nodes_offset, nodes.data(), nodes.size_bytes());
+  put(h.ids_offset, ids.data(), ids.size() * sizeof(int));
+  if (with_features)
+    put(h.features_offset, features.data(), features.size() * sizeof(double));
+
+  if (!out) {
+    std::cerr << "Error: No se pudo escribir " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+template <size_t D>
+bool VP_tree<D>::load_index(const std::string &path, bool verify) {
+  if (!std::filesystem::exists(path))
+    return false;
+
+  MappedFile file(path);
+  VPIndexHeader h;
+  if (!file.valid() || file.size() < sizeof(h)) {
+    std::cerr << "Error: " << path << " no es un índice de VP_tree"
+              << std::endl;
+    return false;
+  }
+  std::memcpy(&h, file.data(), sizeof(h));
+
+  if (std::memcmp(h.magic, VP_INDEX_MAGIC, sizeof(h.magic)) != 0 ||
+      h.version != VP_INDEX_VERSION) {
+    std::cerr << "Error: " << path << " no es un índice de VP_tree v"
+              << VP_INDEX_VERSION << std::endl;
+    return false;
+  }
+  if (D != DYNAMIC_DIMS && h.dims < D) {
+    std::cerr << "Error: el índice tiene " << h.dims
+              << " dimensiones, el árbol espera " << D << std::endl;
+    return false;
+  }
+
+  bool has_features = h.flags & VP_INDEX_FEATURES;
+  std::uint64_t nodes_end, ids_end, cells, features_end;
+  if (h.rows == 0 || h.rows >= VP_NO_CHILD || h.stride < h.dims ||
+      h.nodes_offset < sizeof(h) ||
+      !sectionEnd(h.nodes_offset, h.rows, sizeof(VPFlatNode), nodes_end) ||
+      nodes_end > h.ids_offset ||
+      !sectionEnd(h.ids_offset, h.rows, sizeof(int), ids_end) ||
+      ids_end > file.size() || h.nodes_offset % alignof(VPFlatNode) != 0 ||
+      (has_features &&
+       (h.features_offset < ids_end ||
+        h.features_offset % DATASET_ALIGNMENT != 0 ||
+        __builtin_mul_overflow(h.rows, h.stride, &cells) ||
+        !sectionEnd(h.features_offset, cells, sizeof(double),
+                    features_end) ||
+        features_end > file.size()))) {
+    std::cerr << "Error: " << path << " está truncado o corrupto"
+              << std::endl;
+    return false;
+  }
+
+  // Sin dataset propio (o con uno que venía del índice anterior) las
+  // coordenadas tienen que salir del archivo
+  bool use_file_features = data.empty() || data_in_index;
+  if (use_file_features && !has_features) {
+    std::cerr << "Error: " << path
+              << " no incluye características y el árbol no tiene dataset"
+              << std::endl;
+    return false;
+  }
+  if (!use_file_features && h.fingerprint != data.fingerprint()) {
+    std::cerr << "Aviso: " << path << " corresponde a otro dataset"
+              << std::endl;
+    return false;
+  }
+
+  auto section = [&](std::uint64_t offset) { return file.data() + offset; };
+  std::span<const VPFlatNode> nodes(
+      reinterpret_cast<const VPFlatNode *>(section(h.nodes_offset)), h.rows);
+  std::span<const int> ids(
+      reinterpret_cast<const int *>(section(h.ids_offset)), h.rows);
+  std::span<const double> features;
+  if (has_features)
+    features = {reinterpret_cast<const double *>(section(h.features_offset)),
+                h.rows * h.stride};
+
+  if (verify) {
+    std::uint64_t sum = checksum(nodes.data(), nodes.size_bytes());
+    sum = checksum(ids.data(), ids.size_bytes(), sum);
+    sum = checksum(features.data(), features.size_bytes(), sum);
+    if (sum != h.checksum) {
+      std::cerr << "Error: checksum incorrecto en " << path << std::endl;
+      return false;
+    }
+  }
+
+  if (use_file_features) {
+    index_ids.clear();
+    index_ids.reserve(h.rows);
+    for (size_t r = 0; r < h.rows; ++r)
+      index_ids.emplace(ids[r], r);
+    data = DatasetView(features.data(), h.rows, h.dims, h.stride, ids.data(),
+                       &index_ids);
+    data_in_index = true;
+  }
+
+  arena.clear();
+  root = nullptr;
+  compact_nodes = {};
+  implicit_nodes = {};
+  implicit_rows = {};
+  index_file = std::move(file);
+  flat_nodes = nodes;
+  attach();
+
+  seed = h.seed;
+  metrics.radius_sum = h.radius_sum;
+  estimatedMemoryBytes = nodes.size_bytes();
+  return true;
+}
+
+// Dimensiones especializadas, deben coincidir con dispatchDims (point.hpp)
+template class VP_tree<DYNAMIC_DIMS>;
+template class VP_tree<2>;
+template class VP_tree<6>;
+template class VP_tree<10>;
+template class VP_tree<14>;
@@ -1,22 +1,38 @@
 #pragma once
 
 #include "vp_defs.hpp"
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <queue>
 #include <random>
+#include <span>
 #include <string>
 #include <unordered_map>
 #include <utility>
 
+#include "dataset.hpp"
+#include "layout.hpp"
+#include "mapped_file.hpp"
+#include "node_arena.hpp"
+#include "parallel.hpp"
 #include "point.hpp"
-
-class VP_tree {
-  std::random_device rd;
-  std::mt19937 eng{rd()};
-
+#include "search_stats.hpp"
+
+// D fija la dimensión de los vectores de características en compilación
+// (std::array); con DYNAMIC_DIMS se usa std::vector
+template <size_t D = DYNAMIC_DIMS> class VP_tree {
+  std::uint64_t seed{std::random_device{}()};
+  unsigned build_threads{1};
+  VPSearchOrder search_order{VPSearchOrder::DepthFirst};
+  double epsilon{};
+  size_t distance_budget{};
+
+  inline double euclidsq_to(size_t i, const double *q) const;
   inline double euclidsq_dist(size_t i, size_t j) const;
+  inline double euclid_to(const double *v, const double *q) const;
 
   typedef std::priority_queue<VPNeig, std::vector<VPNeig>,
                               decltype([](const VPNeig &lhs,
@@ -26,59 +42,193 @@ class VP_tree {
       NodeMaxHeap;
 
   size_t nobjs{};
-  std::unique_ptr<VPNode> root;
-
-  std::vector<std::vector<double>> feat_vecs;
+  size_t dims{};
+  // Nodos en preorden dentro de la arena; build() la libera de una vez
+  NodeArena<VPNode> arena;
+  VPNode *root{};
+
+  // Con VPLayout::Compact el árbol se pasa aquí tras el build y la arena se
+  // libera; en el mismo orden que la arena, así la raíz es el último nodo
+  std::vector<VPCompactNode> compact_nodes;
+
+  // VPLayout::Implicit: registros de implicit_stride() doubles por nivel y
+  // la fila de cada nodo aparte (ver VPImplicitCursor)
+  std::vector<double> implicit_nodes;
+  std::vector<std::uint32_t> implicit_rows;
+  size_t implicit_stride() const { return VP_IMPLICIT_HEADER + dims; }
+
+  // Coordenadas: la vista recibida (no se copia, el Dataset debe vivir más
+  // que el árbol) o una copia propia si se construye desde vector<Point>.
+  // Los nodos guardan filas; los ids solo aparecen en la interfaz pública.
+  std::unique_ptr<Dataset> owned;
+  DatasetView data;
   std::vector<int> points;
 
-  std::unique_ptr<VPNode> _build(std::vector<int> &objs, size_t i, size_t j);
-
-  void print_tree(VPNode *node);
+  // Índice proyectado por load_index: si flat_nodes no está vacío las
+  // búsquedas lo recorren en lugar de root. Si el archivo aporta las
+  // características, data apunta a él e index_ids es su mapa id -> fila.
+  MappedFile index_file;
+  std::span<const VPFlatNode> flat_nodes;
+  std::unordered_map<int, size_t> index_ids;
+  bool data_in_index{false};
+
+  // (distancia^2 al vantage point, id) de cada objeto de la partición actual;
+  // cada distancia se calcula una sola vez por nivel
+  std::vector<std::pair<double, int>> scratch;
+  bool keep_bounds{true};
+
+  void attach();
+
+  // Vantage point de objs[i, j) (queda en objs[j - 1]) y reparto del resto:
+  // objs[i, split) a distancia <= r y objs[split, j - 1) a distancia >= r
+  struct Partition {
+    int vp;
+    double r, near_lo, far_hi;
+  };
+  Partition _partition(std::vector<int> &objs, size_t i, size_t j,
+                       size_t split, unsigned threads);
+
+  VPNode *_build(std::vector<int> &objs, size_t i, size_t j, unsigned threads,
+                 size_t &radius_sum, NodeArena<VPNode>::Slots &slots);
+  void _build_implicit(std::vector<int> &objs, size_t i, size_t j, size_t pos,
+                       unsigned threads, size_t &radius_sum);
+
+  // Llama a f con un cursor a la raíz del índice proyectado, del arreglo
+  // compacto o del árbol de punteros
+  template <class F> decltype(auto) visit_root(F &&f) const {
+    if (!flat_nodes.empty())
+      return f(VPFlatCursor{flat_nodes.data(), 0});
+    if (!compact_nodes.empty())
+      return f(VPCompactCursor{
+          compact_nodes.data(),
+          static_cast<std::uint32_t>(compact_nodes.size() - 1)});
+    if (!implicit_rows.empty())
+      return f(VPImplicitCursor{implicit_nodes.data(), implicit_rows.data(),
+                                implicit_stride(), implicit_rows.size(), 0});
+    return f(VPNodeCursor{root});
+  }
 
-  void _radial_search(VPNode *node, size_t id, double r,
-                      std::vector<int> &objs);
+  // Coordenadas del vantage point: en el nodo si el layout las guarda, si
+  // no la fila del dataset
+  template <class Cursor> const double *vantage(Cursor node) const {
+    if constexpr (requires { node.coords(); })
+      return node.coords();
+    else
+      return data.row(node.id());
+  }
 
-  void _nn(VPNode *node, size_t ref_id, size_t &best_id, double &best_dist);
-  void _knn(VPNode *node, size_t id, double &u, NodeMaxHeap &heap, size_t n);
+  std::uint32_t _flatten(const VPNode *node,
+                         std::vector<VPFlatNode> &out) const;
+  std::uint32_t _compact(const VPNode *node,
+                         std::vector<VPCompactNode> &out) const;
+
+  template <class Cursor> void print_tree(Cursor node);
+  template <class Cursor> size_t _depth(Cursor node) const;
+
+  template <class Cursor>
+  void _radial_search(Cursor node, size_t row, double r,
+                      std::vector<int> &objs, SearchStats &stats) const;
+
+  // Las búsquedas reciben el vector consulta y sus propias métricas, así
+  // varios hilos pueden recorrer el árbol a la vez
+  template <class Cursor>
+  void _nn(Cursor node, const double *q, size_t &best_id, double &best_dist,
+           SearchStats &stats, VPApprox &approx) const;
+  template <class Cursor>
+  void _knn(Cursor node, const double *q, double &u, NodeMaxHeap &heap,
+            size_t n, SearchStats &stats, VPApprox &approx) const;
+  template <class Cursor>
+  void _knn_best_first(Cursor root, const double *q, double &u,
+                       NodeMaxHeap &heap, size_t n, SearchStats &stats,
+                       VPApprox &approx) const;
+  // Modo aproximado de una consulta que empieza con stats
+  VPApprox _approx_for(const SearchStats &stats) const;
+  // kNN desde la raíz con el orden de search_order; suma la consulta a
+  // stats.truncatedQueries si se corta por distance_budget
+  void _knn_query(const double *q, double &u, NodeMaxHeap &heap, size_t n,
+                  SearchStats &stats) const;
 
 public:
   size_t estimatedMemoryBytes{};
 
-  struct Metrics {
-    size_t radius_sum{};
-    size_t totalDistanceCalls{};
-    size_t lastVisitedNodes{};
-    size_t totalNodesVisited{};
-    size_t totalNodesPruned{};
-  } metrics;
-
-  void build();
-  bool puntal_search(size_t id);
-
-  std::vector<int> radial_search(size_t id, double r);
+  using Metrics = VPMetrics;
+  Metrics metrics;
+
+  // Compact reduce el nodo a 16 bytes (la mitad de caché por nivel) a cambio
+  // de no guardar las cotas de shell_bounds. Implicit parte en
+  // leftSubtreeSize en vez de la mediana y copia las coordenadas de cada
+  // vantage point a su nodo. Si el árbol no cabe en índices de 32 bits se
+  // usa Pointer
+  void build(bool shell_bounds = true, VPLayout layout = VPLayout::Pointer);
+
+  // Guarda el árbol construido (o cargado) para recargarlo con load_index
+  // sin reconstruir. with_features copia también las coordenadas, así el
+  // archivo basta por sí solo. false (y mensaje por cerr) si falla.
+  bool save_index(const std::string &path, bool with_features = false) const;
+
+  // Proyecta un índice de save_index: las búsquedas leen el archivo
+  // directamente. Si el árbol se creó sobre un dataset, el índice debe
+  // corresponder a él; si se creó sobre una vista vacía, se usan las
+  // características del archivo. Devuelve false (y el árbol queda como
+  // estaba) si el archivo no existe o no es válido. verify = false omite el
+  // checksum para no tocar todas las páginas al arrancar.
+  bool load_index(const std::string &path, bool verify = true);
+
+  // Misma semilla => mismo árbol, sin importar el número de hilos
+  void set_seed(std::uint64_t s) { seed = s; }
+  std::uint64_t get_seed() const { return seed; }
+  // Hilos para build(); 0 usa todos los núcleos disponibles
+  void set_build_threads(unsigned threads) {
+    build_threads = resolveThreads(threads);
+  }
+  // Orden de visita de knn / knn_batch; mismo resultado, distinta poda
+  void set_search_order(VPSearchOrder order) { search_order = order; }
+  VPSearchOrder get_search_order() const { return search_order; }
+  // Búsqueda aproximada de nn / knn / knn_batch. Con epsilon > 0 cada
+  // vecino devuelto está a lo sumo (1 + epsilon) veces más lejos que el
+  // exacto de su posición; con budget > 0 cada consulta evalúa como mucho
+  // budget distancias y puede devolver vecinos peores (las cortadas suman
+  // SearchStats::truncatedQueries). 0 y 0 es la búsqueda exacta
+  void set_epsilon(double e) { epsilon = std::max(e, 0.0); }
+  double get_epsilon() const { return epsilon; }
+  void set_distance_budget(size_t budget) { distance_budget = budget; }
+  size_t get_distance_budget() const { return distance_budget; }
+
+  // Las consultas son const y reentrantes; las métricas se suman al
+  // SearchStats del llamador si se pasa uno
+  bool puntal_search(size_t id) const;
+
+  std::vector<int> radial_search(size_t id, double r,
+                                 SearchStats *stats = nullptr) const;
 
   void print_tree();
   void reset_metrics();
-  void reset_search_metrics();
 
-  double get_last_prunning_rate();
-  size_t get_last_visited_nodes();
-  size_t get_total_distance_calls();
-  double get_average_partition_radius();
+  // Fracción de objetos no visitados, promediada sobre stats.queries
+  double get_prunning_rate(const SearchStats &stats) const;
+  double get_average_partition_radius() const;
   size_t get_depth() const;
   size_t get_depth(VPNode *node) const;
 
-  int nn(size_t id);
-  std::vector<int> knn(size_t id, size_t n);
+  int nn(size_t id, SearchStats *stats = nullptr) const;
+  std::vector<int> knn(size_t id, size_t n,
+                       SearchStats *stats = nullptr) const;
+
+  // kNN para nq consultas (matriz fila por fila de get_dims() columnas)
+  // repartidas entre hilos; 0 usa todos los núcleos. Resultados ordenados
+  // por distancia en out_ids/out_dists[q * k + i], con -1 / infinito si hay
+  // menos de k objetos. Las métricas de cada hilo se suman a stats al final.
+  void knn_batch(const double *queries, size_t nq, size_t k, int *out_ids,
+                 double *out_dists, unsigned threads = 0,
+                 SearchStats *stats = nullptr) const;
+
+  size_t get_dims() const { return dims; }
 
-  VP_tree(std::vector<Point> &data) {
-    nobjs = data.size();
-    feat_vecs.resize(5000); // TODO: menor?
-    points.reserve(nobjs);
+  VP_tree(const DatasetView &dataset) : data(dataset) { attach(); }
 
-    for (auto &p : data) {
-      feat_vecs[p.id] = p.coords;
-      points.push_back(p.id);
-    }
+  VP_tree(const std::vector<Point> &dataset)
+      : owned(std::make_unique<Dataset>(Dataset::fromPoints(dataset))),
+        data(owned->view()) {
+    attach();
   }
 };